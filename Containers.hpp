@@ -24,23 +24,61 @@ using namespace std;
 #include <stdint.h>
 #include <inttypes.h>
 #include <algorithm>
+#include <new>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
 
 ////////////////////////////////// RingBufferSPMC /////////////////////////////////////////////////////
+//Single writer, many readers. Buffer layout is [count][stamp per slot][pad][slots] so it can live in
+//shared memory. The pad aligns the slots to alignof(DO) when that is over 8 bytes. A slot stamp is 2*seq+1 while the writer copies seq into it and 2*seq+2 once done,
+//readers check the stamp after copying to detect a torn (lapped) element.
+#define RING_READ_OK       0
+#define RING_READ_EMPTY    1
+#define RING_READ_OVERRUN  2
+
 template <typename DO>
 class RingBufferSPMC
 {
 	public:
-		RingBufferSPMC() :  _capacity(0) {}   
-		virtual ~RingBufferSPMC() { _count->~atomic<uint64_t>(); }
+		//zero copy view of claimed elements, second span is used when the claim wraps
+		struct Claim
+		{
+			const DO * first;
+			size_t     first_count;
+			const DO * second;
+			size_t     second_count;
+			uint64_t   start;		//sequence of first[0]
+			uint64_t   overrun;		//elements lost between the requested and start sequence
+			size_t size() const { return first_count + second_count; }
+			const DO& operator[](size_t i) const { return (i < first_count)? first[i]:second[i-first_count]; }
+		};
 
-		//can be done only once
-		void setBuffer(void * sBuf, int size)
+		RingBufferSPMC() :  _array(NULL), _count(NULL), _stamps(NULL), _capacity(0) {}   
+		virtual ~RingBufferSPMC() {}
+
+		//can be done only once. init=false attaches to a buffer already set up by another process
+		void setBuffer(void * sBuf, int size, bool init = true)
 		{
 			if ( _capacity > 0) return;
-			_array = (DO *) sBuf;
-			_capacity = ((size-8)/sizeof(DO));
-			memset(_array, 0, size);
-			_count = new (&_array[_capacity]) std::atomic<uint64_t>(0) ;
+			size_t overhead = sizeof(uint64_t) + ((alignof(DO) > sizeof(uint64_t))? alignof(DO) - 1: 0);
+			_capacity = ((size_t) size > overhead)? (size - overhead) / (sizeof(uint64_t) + sizeof(DO)): 0;
+			_count  = (std::atomic<uint64_t> *) sBuf;
+			_stamps = _count + 1;
+			uintptr_t slots = (uintptr_t) (_stamps + _capacity);
+			_array  = (DO *) ((slots + alignof(DO) - 1) & ~(uintptr_t) (alignof(DO) - 1));
+			if (!init) return;
+			memset(sBuf, 0, size);
+			new (_count) std::atomic<uint64_t>(0);
+			for (size_t i = 0; i < _capacity; i++)
+				new (&_stamps[i]) std::atomic<uint64_t>(0);
 		}
 		
 		uint64_t end() { 
@@ -50,27 +88,118 @@ class RingBufferSPMC
 		//write will not wait or get blocked	
 		void write(const DO& rec)
 		{ 
-			uint64_t index = end();
-			_array[index%_capacity] = rec;
+			uint64_t index = _count->load(std::memory_order_relaxed);
+			size_t slot = index%_capacity;
+			_stamps[slot].store(2*index+1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			_array[slot] = rec;
+			_stamps[slot].store(2*index+2, std::memory_order_release);
 			_count->store(index+1, std::memory_order_release);              
 		}	
 		
 		//Return false if requested sequence is ahead of the write. 
 		//Return oldest msg, if requested sequence is out of range.
 		bool read(DO& item, const uint64_t& iReq, uint64_t& iRes)
+		{
+			uint64_t seq = iReq;
+			for (;;)
+			{
+				uint64_t index = end();
+				if ( index <= seq ) return false; 			  	//nothing to read
+				iRes = oldest(index, seq);
+				if (tryRead(item, iRes) == RING_READ_OK) return true;
+				seq = iRes + 1;								//lapped while copying
+			}
+		}
+
+		//Copies element seq if it is still consistent. Returns RING_READ_EMPTY when seq is not
+		//yet written and RING_READ_OVERRUN when it was overwritten before or during the copy.
+		int tryRead(DO& item, uint64_t seq)
+		{
+			if ( end() <= seq ) return RING_READ_EMPTY;
+			size_t slot = seq%_capacity;
+			if (_stamps[slot].load(std::memory_order_acquire) != 2*seq+2)
+				return RING_READ_OVERRUN;
+			item = _array[slot];
+			return consistent(seq)? RING_READ_OK:RING_READ_OVERRUN;
+		}
+
+		//Claims upto maxCount published elements from iReq without copying. The slot under 
+		//the writer is never claimed. Returns the number of elements claimed (0 if none).
+		size_t claim(uint64_t iReq, size_t maxCount, Claim& c)
 		{
 			uint64_t index = end();
-			if ( index <= iReq ) return false; 			  	//nothing to read
-			iRes = ( index >= iReq + _capacity )? 
-				index - _capacity + 1:iReq;
-			item = _array[iRes%_capacity];
-			return true;
+			c.first = c.second = NULL;
+			c.first_count = c.second_count = 0;
+			c.start = oldest(index, iReq);
+			c.overrun = c.start - iReq;
+			if ( index <= c.start || maxCount == 0 ) return 0;
+			size_t count = (size_t) std::min<uint64_t>(index - c.start, maxCount);
+			size_t slot  = c.start % _capacity;
+			c.first = &_array[slot];
+			c.first_count = std::min(count, _capacity - slot);
+			if (count > c.first_count)
+			{
+				c.second = _array;
+				c.second_count = count - c.first_count;
+			}
+			return count;
 		}
 
+		//Seqlock style check once a claim is consumed. Returns the number of leading elements
+		//of the claim that the writer overwrote meanwhile (0 means the whole claim was consistent).
+		size_t lapped(const Claim& c)
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+			for (size_t i = c.size(); i > 0; i--)
+				if (_stamps[(c.start + i - 1)%_capacity].load(std::memory_order_relaxed) != 2*(c.start + i - 1)+2)
+					return i;
+			return 0;
+		}
+
+		//Copies upto maxCount elements from iReq into items. iRes is set to the sequence of
+		//items[0] and overrun to the number of elements lost before it, including any that
+		//were overwritten while copying. Returns the count copied.
+		size_t read_n(DO * items, size_t maxCount, const uint64_t& iReq, uint64_t& iRes, uint64_t& overrun)
+		{
+			Claim c;
+			size_t count = claim(iReq, maxCount, c);
+			iRes = c.start;
+			overrun = c.overrun;
+			if (count == 0) return 0;
+			std::copy(c.first, c.first + c.first_count, items);
+			std::copy(c.second, c.second + c.second_count, items + c.first_count);
+			size_t torn = lapped(c);
+			if (torn > 0)
+			{
+				std::copy(items + torn, items + count, items);
+				count   -= torn;
+				iRes    += torn;
+				overrun += torn;
+			}
+			return count;
+		}
+
+		size_t capacity() const { return _capacity; }
+
 	private:
+		//oldest sequence that is safe to read at iReq, given the writer is at index
+		uint64_t oldest(uint64_t index, uint64_t iReq) const
+		{
+			return ( index >= iReq + _capacity )? index - _capacity + 1:iReq;
+		}
+
+		//true if the slot of seq was not touched since it was copied
+		bool consistent(uint64_t seq)
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return _stamps[seq%_capacity].load(std::memory_order_relaxed) == 2*seq+2;
+		}
+
 		DO * _array;
 		std::atomic<uint64_t> * _count; 
-		int _capacity; 
+		std::atomic<uint64_t> * _stamps;
+		size_t _capacity; 
 };
 
 
@@ -80,7 +209,7 @@ class SPSCQueue {
     public:
         enum { Capacity = Size+1 };
 
-        SPSCQueue() : _tail(0), _head(0){}   
+        SPSCQueue() : _head(0), _tail(0){}   
         virtual ~SPSCQueue() {}
         
         bool push(const Element& item)
@@ -130,7 +259,333 @@ class SPSCQueue {
         std::atomic<size_t>  _tail;  
 };
 
+///////////////////////////////////// SPSCRing //////////////////////////////////////////////////
+//Single producer single consumer ring. Size must be a power of two and all Size slots are usable.
+//Head and tail live on separate cache lines together with the side's cached copy of the remote
+//index, so the remote index is only reloaded when the cached copy says full (or empty).
+#define CACHE_LINE_SIZE 64
+template <typename Element, size_t Size> 
+class SPSCRing {
+    static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "SPSCRing size must be a power of two");
+
+    public:
+        typedef Element value_type;
+        enum { Capacity = Size, Mask = Size - 1 };
+
+        SPSCRing() : _tail(0), _head_cache(0), _head(0), _tail_cache(0) {}
+        virtual ~SPSCRing() {}
+
+        bool push(const Element& item)
+        {
+          const size_t tail = _tail.load(std::memory_order_relaxed);
+          if (tail - _head_cache == Capacity)
+          {
+            _head_cache = _head.load(std::memory_order_acquire);
+            if (tail - _head_cache == Capacity)
+              return false; // full queue
+          }
+          _array[tail & Mask] = item;
+          _tail.store(tail + 1, std::memory_order_release);
+          return true;
+        }
+
+        bool pop(Element& item)
+        {
+          const size_t head = _head.load(std::memory_order_relaxed);
+          if (head == _tail_cache)
+          {
+            _tail_cache = _tail.load(std::memory_order_acquire);
+            if (head == _tail_cache)
+              return false; // empty queue
+          }
+          item = std::move(_array[head & Mask]);
+          _head.store(head + 1, std::memory_order_release);
+          return true;
+        }
+
+        //pushes upto count items with a single publish, returns the number pushed
+        size_t push_n(const Element* items, size_t count)
+        {
+          const size_t tail = _tail.load(std::memory_order_relaxed);
+          size_t avail = Capacity - (tail - _head_cache);
+          if (avail < count)
+          {
+            _head_cache = _head.load(std::memory_order_acquire);
+            avail = Capacity - (tail - _head_cache);
+          }
+          if (count > avail) count = avail;
+          for (size_t i = 0; i < count; i++)
+            _array[(tail + i) & Mask] = items[i];
+          if (count > 0) _tail.store(tail + count, std::memory_order_release);
+          return count;
+        }
+
+        //pops upto count items with a single release, returns the number popped
+        size_t pop_n(Element* items, size_t count)
+        {
+          const size_t head = _head.load(std::memory_order_relaxed);
+          size_t avail = _tail_cache - head;
+          if (avail < count)
+          {
+            _tail_cache = _tail.load(std::memory_order_acquire);
+            avail = _tail_cache - head;
+          }
+          if (count > avail) count = avail;
+          for (size_t i = 0; i < count; i++)
+            items[i] = std::move(_array[(head + i) & Mask]);
+          if (count > 0) _head.store(head + count, std::memory_order_release);
+          return count;
+        }
+
+        bool empty() const
+        {
+          return (_head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire));
+        }
+
+        bool full() const
+        {
+          return (_tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire) == Capacity);
+        }
+
+        size_t size() const
+        {
+          return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+        }
+
+    private:
+        //producer line
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> _tail;
+        size_t _head_cache;
+        //consumer line
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> _head;
+        size_t _tail_cache;
+        alignas(CACHE_LINE_SIZE) Element _array[Capacity];
+};
+///////////////////////////////////// Shared memory queues ///////////////////////////////////////
+//Queues over a caller supplied buffer (eg) SharedMemoryMap or iAttachMem segments, usable between
+//processes. The buffer starts with a self describing header so a peer can attach and validate it.
+//Elements are copied in and out, so they must be trivially copyable (no pointers across processes).
+//
+//Lifecycle: one side calls create (initializes the buffer), peers call attach (validates the header).
+//When a peer crashes, the survivor calls reinit which drops queued data and bumps the generation.
+//Attached peers check stale() and attach again, until then their push and pop fail.
+#define SHM_QUEUE_MAGIC   0x51554555 // "QUEU"
+#define SHM_QUEUE_VERSION 1
+#define SHM_QUEUE_SPSC    1
+#define SHM_QUEUE_MPSC    2
+
+struct ShmQueueHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t type;
+	uint32_t elemsize;
+	uint32_t capacity;
+	std::atomic<uint32_t> generation;
+	alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail;
+	alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;
+};
+
+template <typename Slot, int Type>
+class ShmQueueBase
+{
+	public:
+		ShmQueueBase() : _header(NULL), _slots(NULL), _mask(0), _generation(0) {}
+
+		//bytes of buffer required for capacity (a power of two) elements
+		static size_t required(size_t capacity) { return sizeof(ShmQueueHeader) + capacity * sizeof(Slot); }
+
+		//initializes the buffer, capacity is the largest power of two that fits
+		bool create(void * sBuf, size_t size)
+		{
+			if (sBuf == NULL || size < required(2)) return false;
+			size_t capacity = 2;
+			while (required(capacity * 2) <= size && capacity * 2 <= UINT32_MAX) capacity *= 2;
+			ShmQueueHeader * header = (ShmQueueHeader *) sBuf;
+			header->magic = 0;
+			std::atomic_thread_fence(std::memory_order_release);
+			header->version = SHM_QUEUE_VERSION;
+			header->type = Type;
+			header->elemsize = sizeof(Slot);
+			header->capacity = capacity;
+			new (&header->generation) std::atomic<uint32_t>(0);
+			new (&header->tail) std::atomic<uint64_t>(0);
+			new (&header->head) std::atomic<uint64_t>(0);
+			_header = header;
+			_slots = (Slot *) (header + 1);
+			_mask = capacity - 1;
+			initSlots();
+			std::atomic_thread_fence(std::memory_order_release);
+			header->magic = SHM_QUEUE_MAGIC;
+			_generation = 0;
+			syncCache();
+			return true;
+		}
+
+		//validates the header of a buffer initialized by create
+		bool attach(void * sBuf, size_t size)
+		{
+			ShmQueueHeader * header = (ShmQueueHeader *) sBuf;
+			if (sBuf == NULL || size < sizeof(ShmQueueHeader)) return false;
+			if (header->magic != SHM_QUEUE_MAGIC || header->version != SHM_QUEUE_VERSION ||
+				header->type != Type || header->elemsize != sizeof(Slot)) return false;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (required(header->capacity) > size) return false;
+			_header = header;
+			_slots = (Slot *) (header + 1);
+			_mask = header->capacity - 1;
+			_generation = header->generation.load(std::memory_order_acquire);
+			syncCache();
+			return true;
+		}
+
+		//drops queued data after a peer crash. Peers must not be pushing or popping.
+		void reinit()
+		{
+			if (_header == NULL) return;
+			_header->tail.store(0, std::memory_order_relaxed);
+			_header->head.store(0, std::memory_order_relaxed);
+			initSlots();
+			_generation = _header->generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+			syncCache();
+		}
+
+		//true if the queue was reinitialized since this handle attached. The generation
+		//shares its cache line only with the read only header fields, so checking it on
+		//every push and pop is a cache hit until reinit
+		bool stale() const { return _header == NULL || _generation != _header->generation.load(std::memory_order_acquire); }
+
+		size_t capacity() const { return _mask + 1; }
+
+		size_t size() const
+		{
+			return _header->tail.load(std::memory_order_acquire) - _header->head.load(std::memory_order_acquire);
+		}
+
+		bool empty() const { return size() == 0; }
+
+	protected:
+		virtual void initSlots() {}
+		virtual void syncCache() {}
+
+		ShmQueueHeader * _header;
+		Slot * _slots;
+		uint64_t _mask;
+		uint32_t _generation;
+};
+
+//single producer single consumer queue over shared memory
+template <typename Element>
+class ShmSPSCQueue : public ShmQueueBase<Element, SHM_QUEUE_SPSC>
+{
+	static_assert(std::is_trivially_copyable<Element>::value, "shared memory queues need trivially copyable elements");
+	typedef ShmQueueBase<Element, SHM_QUEUE_SPSC> Base;
+
+	public:
+		ShmSPSCQueue() : _head_cache(0), _tail_cache(0) {}
+
+		bool push(const Element& item)
+		{
+			if (Base::stale()) return false; // reinitialized, attach again
+			const uint64_t tail = Base::_header->tail.load(std::memory_order_relaxed);
+			if (tail - _head_cache > Base::_mask)
+			{
+				_head_cache = Base::_header->head.load(std::memory_order_acquire);
+				if (tail - _head_cache > Base::_mask) return false; // full queue
+			}
+			Base::_slots[tail & Base::_mask] = item;
+			Base::_header->tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		//the cached tail survives a reinit, so the generation is checked before the fast path
+		bool pop(Element& item)
+		{
+			if (Base::stale()) return false; // reinitialized, attach again
+			const uint64_t head = Base::_header->head.load(std::memory_order_relaxed);
+			if (head == _tail_cache)
+			{
+				_tail_cache = Base::_header->tail.load(std::memory_order_acquire);
+				if (head == _tail_cache) return false; // empty queue
+			}
+			item = Base::_slots[head & Base::_mask];
+			Base::_header->head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+	protected:
+		//cached remote indices must not run ahead of the shared ones
+		void syncCache() { _head_cache = _tail_cache = Base::_header->head.load(std::memory_order_acquire); }
+
+	private:
+		uint64_t _head_cache;
+		uint64_t _tail_cache;
+};
+
+//per slot sequence marks the slot as published for the single consumer
+template <typename Element>
+struct ShmSeqSlot
+{
+	std::atomic<uint64_t> seq;
+	Element data;
+};
+
+//multi producer single consumer queue over shared memory (bounded, sequence per slot)
+template <typename Element>
+class ShmMPSCQueue : public ShmQueueBase<ShmSeqSlot<Element>, SHM_QUEUE_MPSC>
+{
+	static_assert(std::is_trivially_copyable<Element>::value, "shared memory queues need trivially copyable elements");
+	typedef ShmQueueBase<ShmSeqSlot<Element>, SHM_QUEUE_MPSC> Base;
+
+	public:
+		bool push(const Element& item)
+		{
+			if (Base::stale()) return false; // reinitialized, attach again
+			uint64_t tail = Base::_header->tail.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				ShmSeqSlot<Element> &slot = Base::_slots[tail & Base::_mask];
+				uint64_t seq = slot.seq.load(std::memory_order_acquire);
+				if (seq == tail)
+				{
+					if (Base::_header->tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+					{
+						slot.data = item;
+						slot.seq.store(tail + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (seq < tail) return false; // full queue
+				else tail = Base::_header->tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		//a producer that died between claiming and publishing a slot stalls the queue (see reinit)
+		bool pop(Element& item)
+		{
+			if (Base::stale()) return false; // reinitialized, attach again
+			const uint64_t head = Base::_header->head.load(std::memory_order_relaxed);
+			ShmSeqSlot<Element> &slot = Base::_slots[head & Base::_mask];
+			if (slot.seq.load(std::memory_order_acquire) != head + 1) return false; // empty queue
+			item = slot.data;
+			slot.seq.store(head + Base::_mask + 1, std::memory_order_release);
+			Base::_header->head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+	protected:
+		void initSlots()
+		{
+			for (uint64_t i = 0; i <= Base::_mask; i++)
+				new (&Base::_slots[i].seq) std::atomic<uint64_t>(i);
+		}
+};
 ////////////////////////////////////// MsgBuffer /////////////////////////////////////////////////
+//Sequenced window of messages [firstSequence, nextAvailableSequence). Capacity is rounded up to a
+//power of two. Producers can reserve() a slot, fill it in place and commit() it. With setSpill the
+//window doubles into a file backed mapping once full, instead of rejecting new messages. Pointers
+//returned by get/oldest/latest/reserve are invalidated when the window grows.
+#define MSGBUF_FULL ((uint64_t)-1)
 
 template <class T>
 class MsgBuffer
@@ -140,15 +595,19 @@ class MsgBuffer
         MsgBuffer()
         {
             capacity_       = 0;
+            mask_           = 0;
             add_count_      = 0;
             flush_count_    = 0;
+            elems_          = nullptr;
+            spill_fd_       = -1;
+            spill_max_      = 0;
+            mapped_         = false;
         }
 
 		~MsgBuffer()
         {
-            if (elems_ == nullptr)
-                return;
-            free (elems_);
+            release(elems_, capacity_);
+            if (spill_fd_ >= 0) close(spill_fd_);
         }
 
         inline int capacity()
@@ -166,22 +625,58 @@ class MsgBuffer
             return add_count_;
         }
     
-        // caller ensures external_memory has room for capacity * sizeof(T) bytes
+        //capacity is rounded up to the next power of two
         void setCapacity(int capacity)
         {
-            capacity_       = capacity;
-            elems_          = (T *)malloc(sizeof(T) * capacity);
+            int size = 1;
+            while (size < capacity) size <<= 1;
+            release(elems_, capacity_);
+            capacity_       = size;
+            mask_           = size - 1;
+            elems_          = (T *)malloc(sizeof(T) * size);
+            mapped_         = false;
         }
 
+        //once full, grow by doubling upto maxCapacity into a mapping of the file at path.
+        //The file is unlinked right away, it only backs the memory. Returns false on error.
+        bool setSpill(const char * path, int maxCapacity)
+        {
+            if (spill_fd_ >= 0) return false;
+            spill_fd_ = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+            if (spill_fd_ < 0) return false;
+            unlink(path);
+            spill_max_ = maxCapacity;
+            return true;
+        }
+
+        inline bool full()
+        {
+            return size() >= capacity_;
+        }
+
+        //slot for the next sequence, nullptr when full. The slot is not part of the
+        //window until commit is called
+		inline T * reserve()
+		{
+            if ( full() && !grow() )
+                return nullptr;
+			return &elems_[add_count_ & mask_];
+		}
+
+        //publishes the reserved slot and returns its sequence
+		inline uint64_t commit()
+		{
+			return add_count_++;
+		}
+
+        //returns the sequence of elem or MSGBUF_FULL
 		inline uint64_t insert(const T &elem)
 		{
-            //Buffer full
-            if ( size() >= capacity_ )
-                return 0;
-            
-			elems_[add_count_++ %capacity_] = elem;
-            
-			return add_count_ - 1;
+            T * slot = reserve();
+            if ( slot == nullptr )
+                return MSGBUF_FULL;
+			*slot = elem;
+			return commit();
 		}
 
 		inline bool flush(uint64_t count)
@@ -201,27 +696,27 @@ class MsgBuffer
         inline T * oldest()
         {
             if ( flush_count_ == add_count_ ) return nullptr;
-            return &elems_[flush_count_%capacity_];
+            return &elems_[flush_count_ & mask_];
         }
 
         inline T * latest()
         {
             if ( flush_count_ == add_count_ ) return nullptr;
-            return &elems_[(add_count_-1)%capacity_];
+            return &elems_[(add_count_-1) & mask_];
         }
 
         bool set(uint64_t count, const T * elem)
         {
             if ( count < flush_count_ || count >= add_count_ )
                 return false;
-            elems_[count%capacity_] = *elem;
+            elems_[count & mask_] = *elem;
             return true;
         }
     
         inline T * get(uint64_t count)
         {
             return ( count < flush_count_ || count >= add_count_ )?
-                            NULL:&elems_[count%capacity_];
+                            NULL:&elems_[count & mask_];
         }
     
 		inline void reset(int sequence = 0)
@@ -231,10 +726,43 @@ class MsgBuffer
         }
 
     private:
+        //doubles the window into the spill file, elements keep their sequence
+        bool grow()
+        {
+            if ( spill_fd_ < 0 || capacity_ == 0 || capacity_ * 2 > spill_max_ )
+                return false;
+            int size = capacity_ * 2;
+            if ( ftruncate(spill_fd_, (off_t)sizeof(T) * size) != 0 )
+                return false;
+            void * mem = mmap(NULL, sizeof(T) * size, PROT_READ | PROT_WRITE, MAP_SHARED, spill_fd_, 0);
+            if ( mem == MAP_FAILED )
+                return false;
+            T * elems = (T *) mem;
+            for (uint64_t seq = flush_count_; seq < add_count_; seq++)
+                new (&elems[seq & (size - 1)]) T(elems_[seq & mask_]);
+            release(elems_, capacity_);
+            elems_      = elems;
+            capacity_   = size;
+            mask_       = size - 1;
+            mapped_     = true;
+            return true;
+        }
+
+        void release(T * elems, int capacity)
+        {
+            if (elems == nullptr) return;
+            if (mapped_) munmap(elems, sizeof(T) * capacity);
+            else free(elems);
+        }
+
         uint64_t    add_count_;     //next empty slot
         uint64_t    flush_count_;   //valid oldest element
         int         capacity_;
+        uint64_t    mask_;
         T *         elems_;
+        int         spill_fd_;
+        int         spill_max_;
+        bool        mapped_;        //elems_ is the spill mapping
         
         MsgBuffer & operator=(const MsgBuffer &); 	//assigment op
         MsgBuffer(const MsgBuffer &);				//copy constructor
@@ -249,10 +777,69 @@ struct CompAdapter : std::binary_function<std::pair<const Key, T>,std::pair<cons
     bool operator()(const Key x, const std::pair<const Key, T>& y) const { return d_comp(x, y.first); }
     bool operator()(const std::pair<const Key, T>& x, const Key y) const { return d_comp(x.first, y); }
     bool operator()(const Key x, const Key y) const { return d_comp(x, y); }
+    bool operator()(const std::pair<Key, T>& x, const std::pair<Key, T> &y) const { return d_comp(x.first, y.first); }
+    bool operator()(const Key x, const std::pair<Key, T>& y) const { return d_comp(x, y.first); }
+    bool operator()(const std::pair<Key, T>& x, const Key y) const { return d_comp(x.first, y); }
     private:
         Comp d_comp;
 };
 
+//Counts the keys below x in a short sorted run. Signed 32 bit keys use SSE2, 64 bit keys need SSE4.2
+template <class Key>
+struct SimdCount
+{
+    static size_t less(const Key * keys, size_t n, const Key& x)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < n; i++)
+            count += (keys[i] < x);
+        return count;
+    }
+};
+
+#if defined(__SSE2__)
+template <>
+struct SimdCount<int32_t>
+{
+    static size_t less(const int32_t * keys, size_t n, const int32_t& x)
+    {
+        size_t count = 0, i = 0;
+        __m128i key = _mm_set1_epi32(x);
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i lt = _mm_cmpgt_epi32(key, _mm_loadu_si128((const __m128i *) &keys[i]));
+            count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+        }
+        for (; i < n; i++)
+            count += (keys[i] < x);
+        return count;
+    }
+};
+#endif
+
+#if defined(__SSE4_2__)
+template <>
+struct SimdCount<int64_t>
+{
+    static size_t less(const int64_t * keys, size_t n, const int64_t& x)
+    {
+        size_t count = 0, i = 0;
+        __m128i key = _mm_set1_epi64x(x);
+        for (; i + 2 <= n; i += 2)
+        {
+            __m128i lt = _mm_cmpgt_epi64(key, _mm_loadu_si128((const __m128i *) &keys[i]));
+            count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(lt)));
+        }
+        for (; i < n; i++)
+            count += (keys[i] < x);
+        return count;
+    }
+};
+#endif
+
+//Flat map kept sorted by key. Meant for small read mostly tables, build it with assign/merge and
+//pick a search layout with setSearch. Branchless, Eytzinger and Simd keep a copy of the keys
+//(rebuilt on every change) so lookups only touch the key array.
 template <class Key, class T, class Comp = std::less<Key>, class Alloc = std::allocator<std::pair<const Key,T>> >
 class SortedVector
 {
@@ -274,18 +861,20 @@ class SortedVector
         typedef typename std::vector<value_type>::reverse_iterator reverse_iterator;
         typedef typename std::vector<value_type>::const_reverse_iterator const_reverse_iterator;
         typedef Alloc AllocType;
+
+        enum Search { Binary, Branchless, Eytzinger, Simd };
         
-    SortedVector(const Alloc& alloc = Alloc()) : d_data(alloc) {}    
+    SortedVector(const Alloc& alloc = Alloc()) : d_data(alloc), d_search(Binary) {}    
     ~SortedVector() {}
     
     inline iterator begin() { return d_data.begin(); }
     inline const_iterator begin() const { return d_data.begin(); }
     inline iterator end() { return d_data.end(); }
     inline const_iterator end() const { return d_data.end(); }
-    inline iterator rbegin() { return d_data.rbegin(); }
-    inline const_iterator rbegin() const { return d_data.rbegin(); }
-    inline iterator rend() { return d_data.rend(); }
-    inline const_iterator rend() const { return d_data.rend(); }
+    inline reverse_iterator rbegin() { return d_data.rbegin(); }
+    inline const_reverse_iterator rbegin() const { return d_data.rbegin(); }
+    inline reverse_iterator rend() { return d_data.rend(); }
+    inline const_reverse_iterator rend() const { return d_data.rend(); }
 
     inline size_type size() const { return d_data.size(); }
     inline bool empty() const { return d_data.empty(); }
@@ -295,6 +884,55 @@ class SortedVector
     {
         d_data.swap(other.d_data);
         std::swap(d_compare,other.d_compare);
+        std::swap(d_search,other.d_search);
+        d_keys.swap(other.d_keys);
+        d_pos.swap(other.d_pos);
+    }
+
+    //layout used by find/lower_bound
+    void setSearch(Search search)
+    {
+        d_search = search;
+        reindex();
+    }
+
+    //replaces the contents with [first, last) using one sort. The first of equal keys is kept
+    template <class InputIt>
+    void assign(InputIt first, InputIt last)
+    {
+        d_data.assign(first, last);
+        std::stable_sort(d_data.begin(), d_data.end(), d_compare);
+        d_data.erase(std::unique(d_data.begin(), d_data.end(), Equal(d_compare)), d_data.end());
+        reindex();
+    }
+
+    //merges a batch sorted by key in one pass. Existing keys win over the batch.
+    //Returns the number of elements added
+    template <class InputIt>
+    size_type merge(InputIt first, InputIt last)
+    {
+        std::vector<std::pair<Key,T>> merged;
+        merged.reserve(d_data.size() + std::distance(first, last));
+        iterator it = d_data.begin();
+        while (first != last)
+        {
+            if (it != d_data.end() && !d_compare(first->first, it->first))
+            {
+                if (!d_compare(it->first, first->first)) ++first;
+                else merged.push_back(*it++);
+            }
+            else 
+            {
+                if (merged.empty() || d_compare(merged.back().first, first->first))
+                    merged.push_back(*first);
+                ++first;
+            }
+        }
+        merged.insert(merged.end(), it, d_data.end());
+        size_type added = merged.size() - d_data.size();
+        d_data.swap(merged);
+        reindex();
+        return added;
     }
 
     inline std::pair<iterator, bool> insert(const value_type& value) 
@@ -305,7 +943,8 @@ class SortedVector
             !(d_compare(value.first,itToInsert->first)))
                 return std::make_pair(itToInsert,false);
         iterator elemIt = d_data.insert(itToInsert, value);
-        return std::make_pair(itToInsert,true);
+        reindex();
+        return std::make_pair(elemIt,true);
     }
     
     bool push_back(const Key key, const T& value)
@@ -313,20 +952,31 @@ class SortedVector
         if (d_data.size() == 0 || d_compare(d_data.back().first,key))
         {
             d_data.push_back(std::make_pair(key,value));
+            reindex();
             return true;    
         }
         return false;
     }
+
+    inline const_iterator lower_bound(const Key key) const {
+        return d_data.begin() + lowerIndex(key);
+    }
+
+    inline iterator lower_bound(const Key key) {
+        return d_data.begin() + lowerIndex(key);
+    }
     
-    inline iterator find(const Key value) const {
-        return const_cast<SortedVector*>(this)->find(value);
+    inline const_iterator find(const Key key) const {
+        const_iterator it = lower_bound(key);
+        if (it != d_data.end() && !(d_compare(key, it->first)))
+            return it;
+        return end();
     }
 
     inline iterator find(const Key key) {
-        iterator it = std::lower_bound(d_data.begin(), d_data.end(), key, d_compare);
-        if (it != d_data.end() && !(d_compare(it->first, key)) &&
-            !(d_compare(key, it->first)))
-                return it;
+        iterator it = lower_bound(key);
+        if (it != d_data.end() && !(d_compare(key, it->first)))
+            return it;
         return end();
     }
 
@@ -334,28 +984,244 @@ class SortedVector
         iterator it = std::lower_bound(d_data.begin(), d_data.end(), key, d_compare);
         if (it != d_data.end() && !(d_compare(it->first, key)) &&
             !(d_compare(key, it->first)))
-                d_data.erase(it);
+                erase(it);
     }
 
-    inline void erase(iterator it) { d_data.erase(it); }
-    inline void erase(iterator fi, iterator la) { d_data.erase(fi, la); }
-    inline void clear() { d_data.clear(); }
-    inline void resize(size_type n, value_type val = value_type()) { d_data.resize(n,val); }
+    inline void erase(iterator it) { d_data.erase(it); reindex(); }
+    inline void erase(iterator fi, iterator la) { d_data.erase(fi, la); reindex(); }
+    inline void clear() { d_data.clear(); reindex(); }
+    inline void resize(size_type n, value_type val = value_type()) { d_data.resize(n,val); reindex(); }
     
     T& operator[](const Key key)
     {
         iterator it = find(key);
         if (it == end())
             it = insert(std::make_pair(key,T())).first;
-        return it.second;
+        return it->second;
     }
     
+    //lookup only, a missing key gives a default value
     const T& operator[](const Key key) const 
     {
-        return const_cast<SortedVector<Key,T,Comp,Alloc>*>(this)->operator[](key);
+        static const T missing = T();
+        const_iterator it = find(key);
+        return (it == end())? missing:it->second;
     }
+
+    private:
+        struct Equal
+        {
+            Equal(const CompFunc& comp) : d_comp(comp) {}
+            bool operator()(const value_type& x, const value_type& y) const { return !d_comp(x.first, y.first) && !d_comp(y.first, x.first); }
+            CompFunc d_comp;
+        };
+
+        //index of the first element not less than key
+        size_t lowerIndex(const Key& key) const
+        {
+            size_t n = d_data.size();
+            if (d_search == Binary || n == 0)
+                return std::lower_bound(d_data.begin(), d_data.end(), key, d_compare) - d_data.begin();
+            if (d_search == Eytzinger)
+            {
+                //keys are in bfs order from 1, descend and then undo the trailing right turns
+                size_t k = 1;
+                while (k <= n)
+                    k = 2 * k + d_compare(d_keys[k], key);
+                k >>= __builtin_ffsll(~k);
+                return (k == 0)? n:d_pos[k];
+            }
+            const Key * base = &d_keys[0];
+            size_t len = n;
+            size_t window = (d_search == Simd)? 16:1;
+            while (len > window)
+            {
+                size_t half = len / 2;
+                base = d_compare(base[half], key)? base + half:base;
+                len -= half;
+            }
+            if (d_search == Simd)
+                return (base - &d_keys[0]) + countLess(base, len, key, std::is_same<Comp, std::less<Key>>());
+            return (base - &d_keys[0]) + d_compare(*base, key);
+        }
+
+        size_t countLess(const Key * keys, size_t n, const Key& key, std::true_type) const
+        {
+            return SimdCount<Key>::less(keys, n, key);
+        }
+
+        size_t countLess(const Key * keys, size_t n, const Key& key, std::false_type) const
+        {
+            size_t count = 0;
+            for (size_t i = 0; i < n; i++)
+                count += d_compare(keys[i], key);
+            return count;
+        }
+
+        //rebuilds the search keys for the current layout
+        void reindex()
+        {
+            d_keys.clear();
+            d_pos.clear();
+            if (d_search == Binary) return;
+            if (d_search != Eytzinger)
+            {
+                for (auto &elem : d_data)
+                    d_keys.push_back(elem.first);
+                return;
+            }
+            d_keys.resize(d_data.size() + 1);
+            d_pos.resize(d_data.size() + 1);
+            size_t i = 0;
+            eytzinger(i, 1);
+        }
+
+        //in order walk of the implicit tree fills it from the sorted data
+        void eytzinger(size_t& i, size_t k)
+        {
+            if (k > d_data.size()) return;
+            eytzinger(i, 2 * k);
+            d_keys[k] = d_data[i].first;
+            d_pos[k] = i++;
+            eytzinger(i, 2 * k + 1);
+        }
+
+        Search d_search;
+        std::vector<Key> d_keys;
+        std::vector<size_t> d_pos;
+};
+
+////////////////////////////////// NodePool /////////////////////////////////////////////////////
+//Fixed size block pool for node based containers (eg) std::set indices.
+//Blocks are carved from chunks of chunknodes blocks so index nodes stay packed
+//together, and chunks can come from a custom allocator (eg) huge pages.
+//Chunk size is fixed when the first chunk is allocated.
+class NodePool
+{
+	public:
+		typedef void *(*chunk_alloc)(size_t size, void * ctx);
+		typedef void  (*chunk_free)(void * chunk, size_t size, void * ctx);
+
+		NodePool(size_t chunknodes = 1024) : d_block(0), d_nodes(chunknodes), d_chunk(0), d_align(0),
+			d_free(NULL), d_alloc(NULL), d_release(NULL), d_ctx(NULL) {}
+
+		~NodePool()
+		{
+			for (auto chunk : d_chunks)
+				if (d_release == NULL) free(chunk);
+				else d_release(chunk, d_chunk, d_ctx);
+		}
+
+		NodePool(const NodePool &) = delete;
+		NodePool& operator= (const NodePool &) = delete;
+
+		//can be done only before the first chunk is allocated. Chunks are rounded
+		//up to a multiple of align (eg) the huge page size
+		bool setAllocator(chunk_alloc alloc, chunk_free release, void * ctx, size_t align = 0)
+		{
+			if (d_chunks.size() > 0) return false;
+			d_alloc = alloc;
+			d_release = release;
+			d_ctx = ctx;
+			d_align = align;
+			return true;
+		}
+
+		//blocks per chunk, can be done only before the first chunk is allocated
+		bool reserve(size_t nodes)
+		{
+			if (d_chunks.size() > 0 || nodes == 0) return false;
+			d_nodes = nodes;
+			return true;
+		}
+
+		//block size is fixed by the first request
+		bool fits(size_t size) const { return d_block == 0 || size <= d_block; }
+
+		void * allocate(size_t size)
+		{
+			if (d_block == 0)
+				d_block = ((std::max(size, sizeof(Block)) + 7) / 8) * 8;
+			if (size > d_block) return NULL;
+			if (d_free == NULL && !addChunk()) return NULL;
+			Block * block = d_free;
+			d_free = block->next;
+			return block;
+		}
+
+		void deallocate(void * ptr)
+		{
+			Block * block = (Block *) ptr;
+			block->next = d_free;
+			d_free = block;
+		}
+
+		size_t chunks() const { return d_chunks.size(); }
+		size_t chunksize() const { return d_chunk; }
+
+	private:
+		struct Block { Block * next; };
+
+		bool addChunk()
+		{
+			if (d_chunk == 0)
+			{
+				d_chunk = d_nodes * d_block;
+				if (d_align > 0) d_chunk = ((d_chunk + d_align - 1) / d_align) * d_align;
+			}
+			char * chunk = (char *) ((d_alloc == NULL)? malloc(d_chunk): d_alloc(d_chunk, d_ctx));
+			if (chunk == NULL) return false;
+			d_chunks.push_back(chunk);
+			for (size_t offset = 0; offset + d_block <= d_chunk; offset += d_block)
+				deallocate(chunk + offset);
+			return true;
+		}
+
+		size_t d_block;
+		size_t d_nodes;
+		size_t d_chunk;
+		size_t d_align;
+		Block * d_free;
+		std::vector<void *> d_chunks;
+		chunk_alloc d_alloc;
+		chunk_free d_release;
+		void * d_ctx;
 };
 
+//Allocator adapter to place single nodes in a NodePool, arrays go to the heap
+template <class T>
+class PoolAllocator
+{
+	template <class U> friend class PoolAllocator;
+
+	public:
+		typedef T value_type;
+
+		PoolAllocator(NodePool * pool) : d_pool(pool) {}
+		template <class U> PoolAllocator(const PoolAllocator<U> &other) : d_pool(other.d_pool) {}
+
+		T * allocate(size_t n)
+		{
+			if (n != 1 || !d_pool->fits(sizeof(T)))
+				return (T *) ::operator new(n * sizeof(T));
+			void * ptr = d_pool->allocate(sizeof(T));
+			if (ptr == NULL) throw std::bad_alloc();
+			return (T *) ptr;
+		}
+
+		void deallocate(T * ptr, size_t n)
+		{
+			if (n != 1 || !d_pool->fits(sizeof(T)))
+				::operator delete(ptr);
+			else d_pool->deallocate(ptr);
+		}
+
+		template <class U> bool operator==(const PoolAllocator<U> &other) const { return d_pool == other.d_pool; }
+		template <class U> bool operator!=(const PoolAllocator<U> &other) const { return d_pool != other.d_pool; }
+
+	private:
+		NodePool * d_pool;
+};
 //////////////////////////////// ZeroOneQueue ///////////////////////////////////////////////////////
 
 /*
@@ -378,6 +1244,9 @@ class SortedVector
  memcpy(indexed_buf+w_index, local_buf, bytesToCopy)
  q.advance_write_ptr()
  
+ Batch reader: n = q.getCount_r(max), read n buffers from r_index, q.advance_read_ptr_by(n)
+ Batch writer: n = q.getCount_w(max), fill n buffers from w_index, q.advance_write_ptr_by(n)
+ 
  */
 
 #if defined (__GNUC__)
@@ -387,7 +1256,7 @@ inline void MF_read_sync(void) { asm volatile("isync":::"memory"); }
 inline void MF_full_sync(void) { asm volatile("sync":::"memory"); }
 #elif defined (__i386) || defined(__x86_64)
 inline void MF_write_sync(void) { asm volatile("sfence":::"memory"); }
-inline void MF_read_sync(void) { asm volatile("ifence":::"memory"); }
+inline void MF_read_sync(void) { asm volatile("lfence":::"memory"); }
 inline void MF_full_sync(void) { asm volatile("mfence":::"memory"); }
 #elif defined(__sparc)
 #define MF_write_sync(void) ((void)0)
@@ -429,78 +1298,82 @@ class ZeroOneQueue
 {
     public:
         ZeroOneQueue(): readp_(0), writep_(0)
-        { std::fill(buf_,buf_+CAPACITY,0x0);}
+        { 
+            for (size_t i = 0; i < CAPACITY; i++)
+                buf_[i].store(0x0, std::memory_order_relaxed);
+        }
 
         // used by readers only    
-        void getReadPos(uint32_t & data) { data = readp_; MF_read_sync(); }
-        bool isEmpty() const { return buf_[readp_] == 0; }
+        void getReadPos(uint32_t & data) const { data = readp_; }
+        bool isEmpty() const { return buf_[readp_].load(std::memory_order_acquire) == 0x0; }
 
-        void advanceReadPtr() {
-            MF_write_sync();    
-            buf_[readp_] = 0x0;
+        void advance_read_ptr() {
+            buf_[readp_].store(0x0, std::memory_order_release);
             readp_ = (readp_+1 == CAPACITY)? 0:readp_+1;
         }
     
+        // releases readSlots slots (all must have been readable) with a single fence
         void advance_read_ptr_by(uint32_t readSlots) {
-            MF_write_sync();    
-            if ( readp_ + readSlots < CAPACITY )
+            std::atomic_thread_fence(std::memory_order_release);
+            for (uint32_t i = 0; i < readSlots; i++)
             {
-                memset(buf_+readp_,0x0,readSlots*sizeof(uint64_t));
-                readp_ += readSlots;
-            }  
-            else   
-            {
-                size_t unit = sizeof (uint64_t);
-                uint32_t slotsAtTheEnd = CAPACITY - readp_;
-                uint32_t slotsInFront = readSlots - slotsAtTheEnd;
-                memset(buf_+readp_,0x0,slotsAtTheEnd*unit);
-                memset(buf_,0x0,slotsInFront*unit);
-                readp_ = slotsInFront;
+                buf_[readp_].store(0x0, std::memory_order_relaxed);
+                readp_ = (readp_+1 == CAPACITY)? 0:readp_+1;
             }
         }
         
-        size_t getCount_r() const 
-        {
-            uint32_t localReadPtr = readp_;
-            if (buf_[localReadPtr] == 0x0) return 0;
-            uint32_t localWritePtr = writep_;
-            uint32_t diff = (localReadPtr > localWritePtr)? 
-                (CAPACITY - (localReadPtr - localWritePtr)):
-                (localWritePtr-localReadPtr);
-            if (diff == 0)
-            {
-                MF_read_sync();
-                if (localReadPtr == 0)
-                {
-                    if (buf_[CAPACITY-1] == 0x0) return 1;
-                    else return CAPACITY;
-                }
-                else if (buf_[localReadPtr-1]== 0x0) return 1;
-                else return CAPACITY;
-            }
-            else return diff;
+        // number of readable slots from the read position (upto maxSlots). Scans the flags,
+        // so it costs O(maxSlots), O(CAPACITY) with the default
+        size_t getCount_r(size_t maxSlots = CAPACITY) const 
+        {
+            return count(readp_, 0x1, maxSlots);
         }
 
-        void getWritePos(uint32_t &data)  { 
-            data = writep_;
-            MF_read_sync(); 
-        }
+        // used by writers only    
+        void getWritePos(uint32_t &data) const { data = writep_; }
         
-        void isFull() const { return buf_[writep_] == 0x1; } 
+        bool isFull() const { return buf_[writep_].load(std::memory_order_acquire) == 0x1; } 
         
         void advance_write_ptr() 
         { 
-            MF_write_sync();
-            buf_[writep_]==0x1;
+            buf_[writep_].store(0x1, std::memory_order_release);
             writep_=(writep_+1 == CAPACITY)? 0:(writep_+1);
         }
+
+        // publishes writeSlots slots (all must have been writable) with a single fence
+        void advance_write_ptr_by(uint32_t writeSlots) 
+        { 
+            std::atomic_thread_fence(std::memory_order_release);
+            for (uint32_t i = 0; i < writeSlots; i++)
+            {
+                buf_[writep_].store(0x1, std::memory_order_relaxed);
+                writep_=(writep_+1 == CAPACITY)? 0:(writep_+1);
+            }
+        }
+
+        // number of writable slots from the write position (upto maxSlots), O(maxSlots) as above
+        size_t getCount_w(size_t maxSlots = CAPACITY) const 
+        {
+            return count(writep_, 0x0, maxSlots);
+        }
         
     private:
-        uint32_t readp_;
-        char cache_line_pad1[128];    //cache line pad size
-        uint32_t writep_;
-        char cache_line_pad2[128];    //cache line pad size
-        uint64_t buf_[CAPACITY];    
+        // the acquire on each flag orders the data access of that slot after the peer's release
+        size_t count(uint32_t pos, uint8_t flag, size_t maxSlots) const
+        {
+            size_t slots = 0;
+            if (maxSlots > CAPACITY) maxSlots = CAPACITY;
+            while (slots < maxSlots && buf_[pos].load(std::memory_order_acquire) == flag)
+            {
+                slots++;
+                pos = (pos+1 == CAPACITY)? 0:pos+1;
+            }
+            return slots;
+        }
+
+        alignas(CACHE_LINE_SIZE) uint32_t readp_;
+        alignas(CACHE_LINE_SIZE) uint32_t writep_;
+        alignas(CACHE_LINE_SIZE) std::atomic<uint8_t> buf_[CAPACITY];    
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,168 @@
+#include "Containers.hpp"
+#include "gtest/gtest.h"
+
+namespace 
+{
+	class ContainersTest : public ::testing::Test { };
+
+	TEST_F(ContainersTest, MsgBufferReserveCommit)
+	{
+		MsgBuffer<int64_t> buffer;
+		buffer.setCapacity(100);
+		ASSERT_EQ(128, buffer.capacity());
+
+		for (int i=0;i<128;i++)
+		{
+			int64_t * slot = buffer.reserve();
+			ASSERT_TRUE(slot != nullptr);
+			*slot = i * 10;
+			ASSERT_EQ((uint64_t)i, buffer.commit());
+		}
+		//full is reported explicitly, 0 is a valid sequence
+		ASSERT_TRUE(buffer.full());
+		ASSERT_TRUE(buffer.reserve() == nullptr);
+		ASSERT_EQ(MSGBUF_FULL, buffer.insert(5));
+
+		ASSERT_TRUE(buffer.flush(9));
+		ASSERT_EQ(10u, buffer.firstSequence());
+		ASSERT_EQ(128u, buffer.insert(1280));
+		ASSERT_EQ(1280, *buffer.get(128));
+		ASSERT_EQ(1280, *buffer.latest());
+		ASSERT_EQ(100, *buffer.oldest());
+		ASSERT_TRUE(buffer.get(9) == NULL);
+	}
+
+	TEST_F(ContainersTest, MsgBufferSpill)
+	{
+		MsgBuffer<int64_t> buffer;
+		buffer.setCapacity(4);
+		ASSERT_TRUE(buffer.setSpill("msgbuffer.spill", 16));
+		buffer.insert(0);
+		buffer.flush(0);
+		//window doubles into the spill mapping, sequences keep their values across the wrap
+		for (int i=1;i<17;i++)
+			ASSERT_EQ((uint64_t)i, buffer.insert(i));
+		ASSERT_EQ(16, buffer.capacity());
+		ASSERT_EQ(MSGBUF_FULL, buffer.insert(17));
+		for (int i=1;i<17;i++)
+			ASSERT_EQ(i, *buffer.get(i));
+	}
+	TEST_F(ContainersTest, NodePoolChunks)
+	{
+		NodePool pool;
+		ASSERT_EQ(true, pool.reserve(100));
+		std::vector<void *> nodes;
+		for (int i = 0; i < 100; i++)
+			nodes.push_back(pool.allocate(24));
+		ASSERT_EQ(1u, pool.chunks());
+		ASSERT_EQ(2400u, pool.chunksize());
+		nodes.push_back(pool.allocate(24));
+		ASSERT_EQ(2u, pool.chunks());
+		ASSERT_EQ(false, pool.reserve(1000));
+		for (auto node : nodes)
+			pool.deallocate(node);
+
+		//chunks are rounded up to the allocator's alignment
+		NodePool aligned;
+		ASSERT_EQ(true, aligned.setAllocator(NULL, NULL, NULL, 4096));
+		ASSERT_EQ(true, aligned.reserve(10));
+		void * node = aligned.allocate(24);
+		ASSERT_NE(nullptr, node);
+		ASSERT_EQ(4096u, aligned.chunksize());
+		aligned.deallocate(node);
+	}
+
+	TEST_F(ContainersTest, SortedVectorBasics)
+	{
+		SortedVector<int, std::string> map;
+		ASSERT_TRUE(map.insert(std::make_pair(5, std::string("five"))).second);
+		auto res = map.insert(std::make_pair(1, std::string("one")));
+		ASSERT_TRUE(res.second);
+		ASSERT_EQ("one", res.first->second);
+		ASSERT_FALSE(map.insert(std::make_pair(5, std::string("FIVE"))).second);
+		map[3] = "three";
+		ASSERT_EQ("three", map[3]);
+		ASSERT_EQ(3u, map.size());
+		ASSERT_EQ(5, map.rbegin()->first);
+		ASSERT_EQ(1, (map.rend() - 1)->first);
+
+		const SortedVector<int, std::string> &cmap = map;
+		ASSERT_EQ("five", cmap[5]);
+		ASSERT_EQ("", cmap[4]);
+		ASSERT_TRUE(cmap.find(4) == cmap.end());
+		ASSERT_EQ(3u, map.size());
+		map.erase(3);
+		ASSERT_TRUE(map.find(3) == map.end());
+	}
+
+	TEST_F(ContainersTest, SortedVectorAssignMerge)
+	{
+		std::vector<std::pair<int64_t, int>> input;
+		for (int i = 0; i < 100; i++)
+			input.push_back(std::make_pair((int64_t)((i * 37) % 50), i));
+		SortedVector<int64_t, int> map;
+		map.assign(input.begin(), input.end());
+		//duplicates keep the first value
+		ASSERT_EQ(50u, map.size());
+		ASSERT_EQ(1, map[37]);
+
+		std::vector<std::pair<int64_t, int>> batch;
+		batch.push_back(std::make_pair((int64_t)-5, -5));
+		batch.push_back(std::make_pair((int64_t)10, -1));
+		batch.push_back(std::make_pair((int64_t)60, 60));
+		batch.push_back(std::make_pair((int64_t)60, 61));
+		batch.push_back(std::make_pair((int64_t)70, 70));
+		ASSERT_EQ(3u, map.merge(batch.begin(), batch.end()));
+		ASSERT_EQ(53u, map.size());
+		ASSERT_EQ(-5, map.begin()->first);
+		ASSERT_EQ(70, map.rbegin()->first);
+		ASSERT_EQ(60, map[60]);
+		ASSERT_NE(-1, map[10]);
+		for (auto it = map.begin(); it + 1 != map.end(); ++it)
+			ASSERT_LT(it->first, (it + 1)->first);
+	}
+
+	template <class Key>
+	void checkSearch(typename SortedVector<Key, int>::Search search)
+	{
+		for (int n = 0; n < 70; n++)
+		{
+			SortedVector<Key, int> map;
+			map.setSearch(search);
+			for (int i = 0; i < n; i++)
+				map.push_back((Key)(i * 3 - 30), i);
+			for (int k = -35; k < n * 3 - 25; k++)
+			{
+				auto it = map.lower_bound((Key)k);
+				int expect = std::max(0, std::min(n, (k + 30 + 2) / 3));
+				ASSERT_EQ(expect, it - map.begin()) << "search " << search << " n " << n << " key " << k;
+				ASSERT_EQ((k % 3 == 0 && k >= -30 && it != map.end()), map.find((Key)k) != map.end());
+			}
+		}
+	}
+
+	TEST_F(ContainersTest, SortedVectorSearchLayouts)
+	{
+		typedef SortedVector<int32_t, int> Map32;
+		typedef SortedVector<int64_t, int> Map64;
+		typedef SortedVector<double, int> MapD;
+		checkSearch<int32_t>(Map32::Binary);
+		checkSearch<int32_t>(Map32::Branchless);
+		checkSearch<int32_t>(Map32::Eytzinger);
+		checkSearch<int32_t>(Map32::Simd);
+		checkSearch<int64_t>(Map64::Eytzinger);
+		checkSearch<int64_t>(Map64::Simd);
+		checkSearch<double>(MapD::Simd);
+
+		//layout is kept across changes
+		Map32 map;
+		map.setSearch(Map32::Eytzinger);
+		map[7] = 1;
+		map[3] = 2;
+		map.erase(7);
+		map[9] = 3;
+		ASSERT_EQ(2, map[3]);
+		ASSERT_EQ(3, map[9]);
+		ASSERT_TRUE(map.find(7) == map.end());
+	}
+}
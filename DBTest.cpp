@@ -139,6 +139,133 @@ namespace
         ASSERT_EQ (8, count);
 	}
 
+	TEST_F(DBTest, RangeWithPrefixReverseAndLimit)
+	{
+		DomainDB &db = DomainDB::instance(1);
+		int count = 0;
+		for (auto stk : db.range<Stock>()) { (void)stk; count++; }
+		ASSERT_EQ(50, count);
+
+		Stock key;
+		key.setAdvBucket(1);
+		auto adv = db.range<Stock>("AdvIndex").prefix(key);
+		count = 0;
+		int lastrow = -1;
+		for (auto stk : adv)
+		{
+			ASSERT_EQ(1, stk->getAdvBucket());
+			ASSERT_LT(lastrow, stk->d_row);
+			lastrow = stk->d_row;
+			count++;
+		}
+		ASSERT_EQ(25, count);
+
+		//N-best from the top of the range
+		std::vector<int> rows;
+		for (auto stk : adv.reverse().limit(3))
+			rows.push_back(stk->d_row);
+		ASSERT_EQ(3u, rows.size());
+		ASSERT_EQ(lastrow, rows[0]);
+		ASSERT_GT(rows[0], rows[1]);
+		ASSERT_GT(rows[1], rows[2]);
+		ASSERT_EQ(lastrow, adv.front()->d_row);
+
+		//same bounds as IterateBetweenStartAndEndByPartialIndex
+		Stock from, to;
+		from.setAdvBucket(1);
+		from.defTicker();
+		to.setAdvBucket(1);
+		to.setTicker("AAPL4");
+		count = 0;
+		for (auto stk : db.range<Stock>("TickerAdvIndex").from(from).to(to))
+			count += stk->getAdvBucket();
+		ASSERT_EQ(8, count);
+		ASSERT_EQ(-1, from.d_row);
+
+		//inverted bounds and unknown index are empty
+		Stock hi, lo;
+		hi.setTicker("AAPL3");
+		lo.setTicker("AAPL1");
+		ASSERT_EQ(true, db.range<Stock>().from(hi).to(lo).empty());
+		ASSERT_EQ(false, db.range<Stock>().from(lo).to(hi).empty());
+		ASSERT_EQ(true, db.range<Stock>("NoSuchIndex").empty());
+		ASSERT_EQ(true, db.range<Stock>().limit(0).empty());
+	}
+	TEST_F(DBTest, ApplyBatch)
+	{
+		DomainDB &db = DomainDB::instance(1);
+		DomainTable<Stock> &stockDB = db.getTable<Stock>();
+		int adv = 7, dark = 1;
+		Stock src;
+		src.setTicker("MSFT");
+		src.setAdvBucket(3);
+
+		//unordered on purpose, the insert reuses the slot of the deleted row
+		std::vector<RowMutation> recs;
+		recs.push_back(RowMutation{5 + stockDB.capacity(), -1, (const char *)&src});
+		for (int row = 19; row >= 10; row--)
+		{
+			recs.push_back(RowMutation{row, 1, (const char *)&adv});
+			recs.push_back(RowMutation{row, 2, (const char *)&dark});
+		}
+		recs.push_back(RowMutation{5, ROW_DELETE, nullptr});
+		ASSERT_EQ(22, db.applyBatch(Stock::TableID(), recs.data(), recs.size()));
+		ASSERT_EQ(-1, db.applyBatch(MAX_TABLE_SIZE - 1, recs.data(), recs.size()));
+
+		ASSERT_EQ(true, stockDB.checkIndex());
+		ASSERT_EQ(50, stockDB.size());
+		ASSERT_EQ(nullptr, stockDB.getObject(5));
+		Stock *stk = stockDB.getObject(5 + stockDB.capacity());
+		ASSERT_NE(nullptr, stk);
+		ASSERT_EQ(3, stk->getAdvBucket());
+
+		//an insert into a slot in use is not applied
+		RowMutation taken{6 + stockDB.capacity(), -1, (const char *)&src};
+		ASSERT_EQ(0, db.applyBatch(Stock::TableID(), &taken, 1));
+		ASSERT_EQ(50, stockDB.size());
+
+		Stock key;
+		key.setAdvBucket(7);
+		int count = 0;
+		for (auto rec : db.range<Stock>("AdvIndex").prefix(key))
+		{
+			ASSERT_EQ(1, rec->getHasDarkQuotes());
+			count++;
+		}
+		ASSERT_EQ(10, count);
+		db.commit();
+	}
+	TEST_F(DBTest, DeleteAllByRange)
+	{
+		DomainDB &db = DomainDB::instance(1);
+		DomainTable<Stock> &stockDB = db.getTable<Stock>();
+
+		//small range, removed from the other indices one by one
+		Stock from, to;
+		from.setTicker("AAPL10");
+		to.setTicker("AAPL12");
+		ASSERT_EQ(3, db.deleteAll<Stock>("PrimaryKey", &from, &to));
+		ASSERT_EQ(47, stockDB.size());
+		ASSERT_EQ(true, stockDB.checkIndex());
+		ASSERT_EQ(nullptr, stockDB.getObject(11));
+		ASSERT_EQ(0, db.deleteAll<Stock>("PrimaryKey", &to, &from));
+
+		//large range, other indices are swept for tombstones
+		Stock key;
+		key.setAdvBucket(1);
+		ASSERT_EQ(24, db.deleteAll<Stock>("AdvIndex", &key, &key));
+		ASSERT_EQ(23, stockDB.size());
+		ASSERT_EQ(true, stockDB.checkIndex());
+		for (auto stk : db.range<Stock>())
+			ASSERT_EQ(0, stk->getAdvBucket());
+
+		//freed slots are reused
+		Stock *stk = stockDB.createObject();
+		ASSERT_NE(nullptr, stk);
+		stk->setTicker("MSFT");
+		ASSERT_EQ(true, stockDB.checkIndex());
+		db.commit();
+	}
 	TEST_F(DBTest, AccessByKeyAndUpdateIndexField) 
 	{
 		DomainTable<Stock> &stockDB = DomainDB::instance(1).getTable<Stock>();
@@ -203,6 +330,133 @@ namespace
 
 	}
 
+	TEST_F(DBTest, TestTableGrowth)
+	{
+		static char sOrdBuf[4*sizeof(Order)];
+		DomainDB &db = DomainDB::instance(3);
+		DomainTable<Order> &orderDB = db.getTable<Order>(sOrdBuf, 4*sizeof(Order));
+		ASSERT_EQ(true, db.setTableGrowth<Order>(4));
+		ASSERT_EQ(4, orderDB.capacity());
+
+		std::vector<Order *> orders;
+		for (int i=0;i<16;i++)
+		{
+			Order *ord = orderDB.createObject();
+			ASSERT_NE(nullptr, ord);
+			ord->setSessionID(1);
+			ord->setClOrdID(i);
+			orders.push_back(ord);
+		}
+		ASSERT_EQ(16, orderDB.capacity());
+		ASSERT_EQ(nullptr, orderDB.createObject());
+
+		//objects created before growth neither move nor change row ids
+		for (int i=0;i<16;i++)
+		{
+			ASSERT_EQ(orders[i], orderDB.getObject(orders[i]->d_row));
+			Order key;
+			key.setSessionID(1);
+			key.setClOrdID(i);
+			ASSERT_EQ(orders[i], db.lookup<Order>(key));
+		}
+		ASSERT_EQ(true, orderDB.checkIndex());
+
+		//freed slots in any segment are reused with new row ids
+		int row = orders[13]->d_row;
+		ASSERT_EQ(true, orderDB.removeObject(row));
+		ASSERT_EQ(nullptr, orderDB.getObject(row));
+		Order *ord = orderDB.createObject();
+		ASSERT_EQ(orders[13], ord);
+		ASSERT_NE(row, ord->d_row);
+
+		db.resetTable<Order>();
+		ASSERT_EQ(0, orderDB.size());
+		ASSERT_EQ(16, orderDB.capacity());
+	}
+
+	TEST_F(DBTest, TestTableGrowthKeepsRowsUnique)
+	{
+		static char sOrdBuf[4*sizeof(Order)];
+		DomainDB &db = DomainDB::instance(5);
+		DomainTable<Order> &orderDB = db.getTable<Order>(sOrdBuf, 4*sizeof(Order));
+		ASSERT_EQ(true, db.setTableGrowth<Order>(2));
+
+		std::set<int> rows;
+		for (int i=0;i<3;i++)
+			rows.insert(orderDB.createObject()->d_row);
+		//a slot freed in this loop only comes back with a new row id
+		ASSERT_EQ(true, orderDB.removeObject(1));
+		//a requested row beyond the capacity grows the table
+		Order *ord = orderDB.createObject(5);
+		ASSERT_NE(nullptr, ord);
+		ASSERT_EQ(5, ord->d_row);
+		rows.insert(5);
+		for (int i=0;i<10 && (ord = orderDB.createObject()) != nullptr;i++)
+			ASSERT_EQ(true, rows.insert(ord->d_row).second);
+		ASSERT_EQ(8, orderDB.capacity());
+
+		//once the loop ran out, slots freed afterwards start the next one
+		ASSERT_EQ(true, orderDB.removeObject(5));
+		ASSERT_EQ(true, orderDB.removeObject(0));
+		for (int i=0;i<2;i++)
+		{
+			ord = orderDB.createObject();
+			ASSERT_NE(nullptr, ord);
+			ASSERT_EQ(true, rows.insert(ord->d_row).second);
+		}
+		ASSERT_EQ(nullptr, orderDB.createObject());
+		ASSERT_EQ(true, orderDB.removeObject(ord->d_row));
+		ord = orderDB.createObject();
+		ASSERT_NE(nullptr, ord);
+		ASSERT_EQ(true, rows.insert(ord->d_row).second);
+		db.resetTable<Order>();
+	}
+
+	TEST_F(DBTest, TestMemPolicy)
+	{
+		//falls back to normal pages when no huge pages are reserved
+		MemPolicy policy = { GX_IPC_HUGE_PAGE_2MB, 1, 0, -1 };
+		void * pMem = NULL;
+		ASSERT_EQ(0, iAllocMem(&pMem, 1000, &policy));
+		ASSERT_NE(nullptr, pMem);
+		memset(pMem, 1, 1000);
+		ASSERT_EQ(0, iFreeMem(pMem, 1000, &policy));
+
+		MemPolicy invalid = { 4096 * 3, 0, 0, -1 };
+		ASSERT_EQ(GX_IPC_ERROR_INVALID_HUGE_PAGE_SIZE, iAllocMem(&pMem, 1000, &invalid));
+		ASSERT_EQ(nullptr, pMem);
+		//nothing stays mapped when the policy cannot be applied
+		MemPolicy unbound = { 0, 0, 0, 63 };
+		ASSERT_EQ(GX_IPC_ERROR_MBIND, iAllocMem(&pMem, 1000, &unbound));
+		ASSERT_EQ(nullptr, pMem);
+
+		DomainDB &db = DomainDB::instance(4);
+		ASSERT_EQ(false, db.setMemPolicy(invalid));
+		ASSERT_EQ(true, db.setMemPolicy(policy));
+		DomainTable<Order> &orderDB = db.getTable<Order>(NULL, 64*sizeof(Order));
+		ASSERT_EQ(false, orderDB.setMemPolicy(invalid));
+		ASSERT_EQ(true, db.setTableGrowth<Order>(2));
+		DomainLogger &logger = db.getLogger(NULL, 4096);
+
+		for (int i=0;i<128;i++)
+		{
+			Order *ord = orderDB.createObject();
+			ASSERT_NE(nullptr, ord);
+			ord->setSessionID(2);
+			ord->setClOrdID(i);
+		}
+		ASSERT_EQ(128, orderDB.capacity());
+		ASSERT_EQ(true, orderDB.checkIndex());
+		Order key;
+		key.setSessionID(2);
+		key.setClOrdID(77);
+		Order *ord = db.lookup<Order>(key);
+		ASSERT_NE(nullptr, ord);
+		ASSERT_EQ(true, logger.log(ord));
+		db.commit();
+		db.resetTable<Order>();
+		ASSERT_EQ(0, orderDB.size());
+	}
 	TEST_F(DBTest, TestEnumCreation)
     {
         Order ord;
@@ -4,6 +4,7 @@
 #include <map>
 #include <vector>
 #include <fstream>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <cstdint>
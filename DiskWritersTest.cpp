@@ -1,4 +1,6 @@
 #include "DiskWriters.hpp"
+#include "Containers.hpp"
+#include <thread>
 #include "gtest/gtest.h"
 
 namespace 
@@ -57,4 +59,98 @@ namespace
 				std::cout << c[i] << std::endl;
 		}
 	}
+
+	struct ShmTestMsg { int32_t producer; int32_t seq; };
+
+	TEST_F(DiskWritersTest, TestShmSPSCQueue)
+	{
+		const uint32_t size = ShmSPSCQueue<ShmTestMsg>::required(1024);
+		//two mappings of the same segment stand in for two processes
+		SharedMemoryMap writermap("test_shm_spsc", size), readermap("test_shm_spsc", size),
+			othermap("test_shm_spsc", size);
+		ShmSPSCQueue<ShmTestMsg> writer, reader;
+		ASSERT_TRUE(writer.create(writermap.init(), size));
+		ASSERT_TRUE(reader.attach(readermap.init(), size));
+		ASSERT_EQ(1024u, reader.capacity());
+
+		void * other = othermap.init();
+		ShmSPSCQueue<int32_t> badtype;
+		ASSERT_FALSE(badtype.attach(other, size));
+		ShmMPSCQueue<ShmTestMsg> badkind;
+		ASSERT_FALSE(badkind.attach(other, size));
+
+		std::thread producer([&writer] {
+			for (int i = 0; i < 100000; i++)
+				while (!writer.push(ShmTestMsg{0, i})) {}
+		});
+		ShmTestMsg msg;
+		for (int i = 0; i < 100000; i++)
+		{
+			while (!reader.pop(msg)) {}
+			ASSERT_EQ(i, msg.seq);
+		}
+		producer.join();
+		ASSERT_TRUE(reader.empty());
+
+		//writer crashed with data in the queue, reader reinitializes and the new writer attaches
+		for (int i = 0; i < 10; i++) ASSERT_TRUE(writer.push(ShmTestMsg{0, i}));
+		reader.reinit();
+		ASSERT_TRUE(writer.stale());
+		ASSERT_FALSE(reader.pop(msg));
+		ASSERT_FALSE(writer.push(ShmTestMsg{0, 11}));
+
+		//a stale reader must not pop slots of the old generation either
+		ShmSPSCQueue<ShmTestMsg> oldreader;
+		ASSERT_TRUE(oldreader.attach(readermap.init(), size));
+		writer.attach(writermap.init(), size);
+		for (int i = 0; i < 4; i++) ASSERT_TRUE(writer.push(ShmTestMsg{0, i}));
+		ASSERT_TRUE(oldreader.pop(msg));
+		reader.reinit();
+		ASSERT_FALSE(oldreader.pop(msg));
+		ASSERT_TRUE(writer.attach(writermap.init(), size));
+		ASSERT_TRUE(writer.push(ShmTestMsg{0, 7}));
+		ASSERT_TRUE(reader.pop(msg));
+		ASSERT_EQ(7, msg.seq);
+	}
+
+	TEST_F(DiskWritersTest, TestShmMPSCQueue)
+	{
+		const uint32_t size = ShmMPSCQueue<ShmTestMsg>::required(256);
+		SharedMemoryMap readermap("test_shm_mpsc", size), writermap1("test_shm_mpsc", size),
+			writermap2("test_shm_mpsc", size);
+		ShmMPSCQueue<ShmTestMsg> reader, writers[2];
+		ASSERT_TRUE(reader.create(readermap.init(), size));
+		ASSERT_TRUE(writers[0].attach(writermap1.init(), size));
+		ASSERT_TRUE(writers[1].attach(writermap2.init(), size));
+
+		const int count = 10000;
+		std::vector<std::thread> producers;
+		for (int p = 0; p < 2; p++)
+			producers.emplace_back([&writers, p] {
+				for (int i = 0; i < count; i++)
+					while (!writers[p].push(ShmTestMsg{p, i})) {}
+			});
+
+		int next[2] = {0, 0};
+		ShmTestMsg msg;
+		for (int i = 0; i < 2 * count; i++)
+		{
+			while (!reader.pop(msg)) {}
+			ASSERT_EQ(next[msg.producer]++, msg.seq);
+		}
+		for (auto &t : producers) t.join();
+		ASSERT_TRUE(reader.empty());
+
+		//full queue rejects pushes
+		for (int i = 0; i < 256; i++) ASSERT_TRUE(writers[0].push(ShmTestMsg{0, i}));
+		ASSERT_FALSE(writers[1].push(ShmTestMsg{1, 0}));
+		reader.reinit();
+		ASSERT_TRUE(writers[1].stale());
+		ASSERT_TRUE(reader.empty());
+		ASSERT_FALSE(writers[1].push(ShmTestMsg{1, 0}));
+		ASSERT_TRUE(writers[1].attach(writermap2.init(), size));
+		ASSERT_TRUE(writers[1].push(ShmTestMsg{1, 1}));
+		ASSERT_TRUE(reader.pop(msg));
+		ASSERT_EQ(1, msg.seq);
+	}
 }  // namespace
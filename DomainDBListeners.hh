@@ -38,6 +38,9 @@ class DBFileSerializer : public DBChangeListener
 
 		const size_t HEADERLEN = 6; // msgsize(2)+transid(4)
 
+		//per table mutations of the message being unpacked (reused across messages)
+		std::vector<RowMutation> d_batch[MAX_TABLE_SIZE];
+
 		//packs metadata information
 		void packMetaData(uint8_t table, uint8_t field, uint32_t row)
 		{
@@ -90,10 +93,17 @@ class DBFileSerializer : public DBChangeListener
 				row = (256 * row) + (uint8_t)d_buffer[pos++]; 
 				//std::cout << "Unpack record = " << (int)table << "," << (int)field << "," << row << std::endl;
 				//process as delete or update based on fieldId
-				if (field == 255) db.delRow(table, row);
-				else db.setRow(&d_buffer[pos], table, row, (field == 254)? -1:field);
+				int32_t fieldid = (field == 255)? ROW_DELETE: (field == 254)? -1:field;
+				d_batch[table].push_back(RowMutation{(int32_t)row, fieldid, &d_buffer[pos]});
 				//only insert and update need to read further
-				pos += db.fieldsize(table,(field == 254)? -1:field);
+				if (field != 255) pos += db.fieldsize(table, fieldid);
+			}
+
+			for (int table = 0; table < MAX_TABLE_SIZE; table++)
+			{
+				if (d_batch[table].empty()) continue;
+				db.applyBatch(table, d_batch[table].data(), d_batch[table].size());
+				d_batch[table].clear();
 			}
 		}
 
@@ -17,6 +17,7 @@ using namespace std;
 #include "macros.hh"
 #include "Containers.hpp"
 #include "GlobalUtils.hpp"
+#include "gx_ipc.h"
 #include <atomic>
 #include <climits>
 
@@ -32,6 +33,11 @@ using namespace std;
 // 3. Tables are initialized with fixed size contiguous memory buffer (shared or local) to manage object allocations. 
 //	  - Records are allocated and managed on that buffer. Table.addObject allocates new object on the buffer 
 //      and table.removeObject deletes object and releases the memory to free pool for reuse.
+//    - Tables can optionally grow (setGrowth) by adding segments of the same size as the initial buffer.
+//      Segments are never moved or released, so object pointers and row ids stay valid across growth.
+//      Segment memory comes from a segment_allocator (malloc by default, or shared memory/mmap segments).
+//    - DomainDB.setMemPolicy places buffers it allocates, grown segments and index nodes on huge pages,
+//      with optional prefault, mlock and numa binding (see MemPolicy in gx_ipc.h).
 //
 // 4. Entity tables: Special tables referencing primary entity in an application. The entity keys are used to 
 //    define relationships and index data in other tables and therefore deserves special handling.  
@@ -70,10 +76,25 @@ template <typename DO> class DomainTable;
 template <int maxsize> class FixedString;
 template <typename DO, size_t maxsize> class FixedArray;
 template <typename DO> class DomainObjectBase;
+template <typename DO> class DomainRange;
 
 #define MAX_FIELD_SIZE 255
 #define MAX_TABLE_SIZE 255
 #define MAX_COLS_SIZE 64
+#define MAX_TABLE_SEGMENTS 64
+
+//Allocates memory for an additional table segment. Returns nullptr if memory is not available.
+typedef void *(*segment_allocator)(const std::string &tablename, int segment, size_t size);
+
+//Row mutation for batch apply (DomainDB::applyBatch). field -1 copies the full row 
+//(insert), ROW_DELETE removes the row. data points to the source bytes of the field.
+#define ROW_DELETE -2
+struct RowMutation
+{
+	int32_t 	 row;
+	int32_t 	 field;
+	const char * data;
+};
 
 DEFINE_ENUM_TYPES(Boolean_t,TRUE,FALSE)
 
@@ -205,6 +226,8 @@ class DomainTableBase
 		virtual size_t fieldsize(int field) = 0;
 		virtual bool removeObject(int id) = 0;
 		virtual int bufcopy(char * sBuf, bool bInOut,int row, int field) = 0;
+		//applies the mutations (reordered by row) and returns the count applied
+		virtual int applyBatch(RowMutation * recs, int count) = 0;
 		virtual bool obj2str(const int &index, std::string &data) = 0;
 		virtual bool str2obj(const std::string &data) = 0;
 		virtual int size(const std::string &indexName = "") const = 0;
@@ -220,27 +243,42 @@ class DomainTable :  DomainTableBase
 
 	public:
 		typedef bool(*compare_func)(const DO * lhs, const DO * rhs);
-		typedef typename std::set<DO *, compare_func> 	Index;
+		typedef typename std::set<DO *, compare_func, PoolAllocator<DO *>> Index;
 		typedef typename Index::iterator 				IndexIterator;
 		typedef typename std::map<string,Index *> 		IndexContainer;
 		typedef typename IndexContainer::iterator 		IndexContainerIterator;
 		
 	private:
 		const uint16_t              d_instanceid;
-		DO *  						d_buffer;
+		DO *  						d_segments[MAX_TABLE_SEGMENTS];
+		int 						d_segment_count;
+		int 						d_segment_max;
+		int 						d_segment_rows;
+		segment_allocator 			d_segment_alloc;
+		MemPolicy 					d_mempolicy;
+		bool 						d_use_mempolicy;
+		NodePool 					d_index_pool; //nodes of all indices
 		deque<int>                  d_buffer_free;
 		int 						d_buffer_free_size;
 		int 						d_buffer_loop;
 		std::map<int,uint64_t> 		d_log_map; //lastbit marks obj deletion
-		int 						d_buffer_max;
+		int 						d_buffer_max; //slots across all segments
+		int 						d_row_stride; //row = d_row_stride * d_buffer_loop + slot
 		std::map<string,Index *> 	d_indices;
 		int 						d_size;
 
 
 		DomainTable<DO>(uint16_t instanceid) :  d_instanceid (instanceid)
 		{
-			d_buffer = NULL;
+			for (int i=0; i < MAX_TABLE_SEGMENTS; i++)
+				d_segments[i] = NULL;
+			d_segment_count = 0;
+			d_segment_max = 1;
+			d_segment_rows = 0;
+			d_segment_alloc = NULL;
+			d_use_mempolicy = false;
 			d_buffer_max = 0;
+			d_row_stride = 0;
 			d_buffer_free_size = 0;
             d_buffer_loop = 0;
             d_size = 0;
@@ -262,10 +300,15 @@ class DomainTable :  DomainTableBase
 		//can be done only once
 		void setBuffer(void * sBuf, int size)
 		{
-			if (d_buffer != NULL) return;
-			d_buffer = (DO *) sBuf;
-			d_buffer_max = size / sizeof(DO);
-			memset(d_buffer, 0 , size);
+			if (d_segment_count > 0) return;
+			d_segment_rows = size / sizeof(DO);
+			d_segments[d_segment_count++] = (DO *) sBuf;
+			d_buffer_max = d_segment_rows;
+			d_row_stride = d_segment_rows * d_segment_max;
+			//a chunk of index nodes per segment
+			d_index_pool.reserve(d_segment_rows * d_indices.size());
+			//free slots carry d_row = -1
+			memset(sBuf, 0xFF, d_segment_rows * sizeof(DO));
             for (int i=0; i < d_buffer_max; i++)
                 d_buffer_free.push_back(i);
             d_buffer_free_size = d_buffer_max;    
@@ -274,6 +317,37 @@ class DomainTable :  DomainTableBase
 			
 		}
 		
+		//Appends a segment of d_segment_rows slots. Existing segments
+		//are left in place so objects never move.
+		bool grow()
+		{
+			if (d_segment_count == 0 || d_segment_count >= d_segment_max) return false;
+			size_t bytes = d_segment_rows * sizeof(DO);
+			void * sBuf = NULL;
+			if (d_segment_alloc != NULL)
+				sBuf = d_segment_alloc(DO::TableName(), d_segment_count, bytes);
+			else if (d_use_mempolicy)
+				iAllocMem(&sBuf, bytes, &d_mempolicy);
+			else sBuf = malloc(bytes);
+			if (sBuf == NULL) return false;
+			memset(sBuf, 0xFF, bytes);
+			d_segments[d_segment_count++] = (DO *) sBuf;
+			//new slots were never used, so they are handed out in the current loop. They go
+			//in front of the slots recycled since the loop started, those wait for the next
+			std::vector<int> slots;
+			for (int i = d_buffer_max; i < d_buffer_max + d_segment_rows; i++)
+				slots.push_back(i);
+			d_buffer_free.insert(d_buffer_free.begin(), slots.begin(), slots.end());
+			d_buffer_free_size += d_segment_rows;
+			d_buffer_max += d_segment_rows;
+			return true;
+		}
+
+		inline DO * slot(int index) const
+		{
+			return (d_segment_count == 1)? &d_segments[0][index]:
+				&d_segments[index / d_segment_rows][index % d_segment_rows];
+		}
 		/*
 		void notifyObjectModified(DO *obj, int fieldIndex) 
 		{
@@ -288,7 +362,7 @@ class DomainTable :  DomainTableBase
 		
 		void addIndex(string index, bool(*c)(const DO * lhs, const DO * rhs)) 
 		{
-			d_indices.insert(make_pair(index,new Index(c)));		
+			d_indices.insert(make_pair(index,new Index(c, PoolAllocator<DO *>(&d_index_pool))));
 		};
 
 		void deleteObjFromIndices(DO * obj) 
@@ -311,11 +385,50 @@ class DomainTable :  DomainTableBase
 			return (iter == d_indices.end())? NULL: iter->second;
 		};
 
+		static void * allocIndexChunk(size_t size, void * ctx)
+		{
+			void * chunk = NULL;
+			iAllocMem(&chunk, size, (MemPolicy *) ctx);
+			return chunk;
+		}
+
+		static void freeIndexChunk(void * chunk, size_t size, void * ctx)
+		{
+			iFreeMem(chunk, size, (MemPolicy *) ctx);
+		}
+
 	public:
 
 		int capacity() const {
 			return d_buffer_max;
 		}
+		//Allows the table to grow to maxsegments segments (initial buffer included) of the initial
+		//buffer size. Row ids are spaced for the max capacity, so it can only be set before any
+		//row is issued. Null allocator implies malloc.
+		bool setGrowth(int maxsegments, segment_allocator allocator = NULL)
+		{
+			if (maxsegments < 1 || maxsegments > MAX_TABLE_SEGMENTS) return false;
+			if (d_size > 0 || d_buffer_loop > 0 || d_segment_count > 1) return false;
+			if ((long long)d_segment_rows * maxsegments > INT_MAX / 2) return false;
+			d_segment_max = maxsegments;
+			d_segment_alloc = allocator;
+			d_row_stride = d_segment_rows * d_segment_max;
+			return true;
+		}
+
+		//Places grown segments (without a custom allocator) and index nodes as per policy.
+		//Index node chunks are rounded up to the huge page size. Can only be set before any row is issued.
+		bool setMemPolicy(const MemPolicy &policy)
+		{
+			if (iCheckMemPolicy(&policy) < 0) return false;
+			if (d_size > 0 || d_buffer_loop > 0 || d_segment_count > 1) return false;
+			size_t align = (policy.lHugePageSize > 0)? policy.lHugePageSize: 0;
+			if (!d_index_pool.setAllocator(allocIndexChunk, freeIndexChunk, &d_mempolicy, align))
+				return false;
+			d_mempolicy = policy;
+			d_use_mempolicy = true;
+			return true;
+		}
 
 		int size(const std::string &indexName = "") const {
             if (indexName == "")
@@ -365,6 +478,50 @@ class DomainTable :  DomainTableBase
 			return copysize;
 		}
 
+		//Mutations are stable sorted by row so that the fields of a row are applied together
+		//and the row is reindexed once. Sorting keeps a delete ahead of an insert into the
+		//same slot, as reused slots always get a higher row id.
+		int applyBatch(RowMutation * recs, int count)
+		{
+			auto byrow = [](const RowMutation &lhs, const RowMutation &rhs) { return lhs.row < rhs.row; };
+			if (!std::is_sorted(recs, recs + count, byrow))
+				std::stable_sort(recs, recs + count, byrow);
+
+			int applied = 0;
+			DO * pending = nullptr; //row taken out of indices for field updates
+			for (int i = 0; i < count; i++)
+			{
+				RowMutation &rec = recs[i];
+				if (pending != nullptr && (rec.field < 0 || pending->d_row != rec.row))
+				{
+					addObjToIndices(pending);
+					pending = nullptr;
+				}
+
+				if (rec.field == ROW_DELETE)
+					applied += removeObject(rec.row);
+				else if (rec.field < 0)
+				{
+					DO key(rec.row);
+					key.clone((char *)rec.data);
+					applied += (copyObject(&key) != nullptr);
+				}
+				else
+				{
+					DO * obj = (pending != nullptr)? pending:getObject(rec.row);
+					if (obj == nullptr) continue;
+					if (pending == nullptr)
+					{
+						deleteObjFromIndices(obj);
+						pending = obj;
+					}
+					applied += (obj->copy(rec.field, (char *)rec.data, true) > 0);
+				}
+			}
+			if (pending != nullptr) addObjToIndices(pending);
+			return applied;
+		}
+
 		bool obj2str(const int &index, std::string &data) 
 		{	
 			auto obj = getObject(index);
@@ -390,33 +547,53 @@ class DomainTable :  DomainTableBase
 			return false;
 		}
     
-        DO * copyObject(DO * obj)
+        //Takes a slot from the free pool and returns the row id for it (-1 if 
+        //the table is full and cannot grow). Requested ids are honoured so that
+        //mirrors keep the row ids of the source table.
+        int allocRow(int id, int &index)
         {
-            if ( d_buffer_free.size() == 0 )
-                return NULL; //Buffer full
+            if ( d_buffer_free.size() == 0 && !grow() )
+                return -1; //Buffer full
+            if ( id >= 0 )
+            {
+                while ( id % d_row_stride >= d_buffer_max )
+                    if (!grow()) return -1;
+            }
+            //the loop ran out with nothing free, what was recycled since starts this one
+            if ( d_buffer_free_size == 0 )
+                d_buffer_free_size = d_buffer_free.size();
             auto itr = d_buffer_free.begin();
-            if (obj->d_row >= 0 )
+            if (id >= 0 )
             {
-            	while (obj->d_row != *itr && itr != d_buffer_free.end()) ++itr;
+            	while (itr != d_buffer_free.end() && id % d_row_stride != *itr) ++itr;
             	if (itr == d_buffer_free.end())
-            		return nullptr;
+            		return -1;
             }
 
-            int index = *itr;
+            index = *itr;
             d_buffer_free.erase(itr);
             d_buffer_free_size--;
+            int row = (id >= 0)? id:d_row_stride * d_buffer_loop + index;
             if ( d_buffer_free_size == 0 )
             {
                 d_buffer_free_size = d_buffer_free.size();
                 d_buffer_loop++;
             }
-            int row = d_buffer_max * d_buffer_loop + index;
+            return row;
+        }
+
+        DO * copyObject(DO * obj)
+        {
+            int index = 0;
+            int row = allocRow(obj->d_row, index);
+            if ( row < 0 )
+                return nullptr;
             //Copy operation from obj makes sure to exclude the last 8 bytes meant 
             //for d_row and dbid. But may be due to byte alignment, we see d_row  
             //still getting updated. Setting it explicitly for now using const cast
-            DO * newobj = new (&d_buffer[index]) DO(row, (void *)obj);
-            *(const_cast< int * >(&d_buffer[index].d_row))  = row;
-            *(const_cast< uint32_t * >(&d_buffer[index].d_dbid)) = d_instanceid;
+            DO * newobj = new (slot(index)) DO(row, (void *)obj);
+            *(const_cast< int * >(&newobj->d_row))  = row;
+            *(const_cast< uint32_t * >(&newobj->d_dbid)) = d_instanceid;
 			d_size++;
             addObjToIndices(newobj);
             newobj->notifyFieldUpdate(-2);
@@ -425,37 +602,23 @@ class DomainTable :  DomainTableBase
     
 		DO * createObject(int id = -1)
 		{
-            if ( d_buffer_free.size() == 0 )
+            int index = 0;
+            int row = allocRow(id, index);
+            if ( row < 0 )
                 return NULL; //Buffer full
-            auto itr = d_buffer_free.begin();
-            if (id >= 0)
-            {
-            	while (id != *itr ) ++itr;
-            	if (itr == d_buffer_free.end())
-            		return nullptr;
-            }
-            int index = *itr;
-            //std::cout << DO::TableName() << ":" << d_buffer_free.size() << std::endl;
-            d_buffer_free.erase(itr);
-            d_buffer_free_size--;
-            if ( d_buffer_free_size == 0 )
-            {
-                d_buffer_free_size = d_buffer_free.size();
-                d_buffer_loop++;
-            }
 			d_size++;
-			addObjToIndices(new (&d_buffer[index]) DO(d_buffer_max * d_buffer_loop + index));
-            *(const_cast< uint32_t * >(&d_buffer[index].d_dbid)) = d_instanceid;
-            d_buffer[index].notifyFieldUpdate(-2);
-			return &d_buffer[index];
+			DO * newobj = new (slot(index)) DO(row);
+			addObjToIndices(newobj);
+            *(const_cast< uint32_t * >(&newobj->d_dbid)) = d_instanceid;
+            newobj->notifyFieldUpdate(-2);
+			return newobj;
 		};
 		
         void reset()
         {
             if (size() == 0 ) return;
-            int idmax = (d_buffer_loop+1)*d_buffer_max;
-            for (int i = 0; i < idmax; i++)
-                removeObject(i);
+            Index * pk = getIndex("PrimaryKey");
+            removeRange(pk, pk->begin(), pk->end());
             d_buffer_free.clear();
             for (int i=0; i < d_buffer_max; i++)
                 d_buffer_free.push_back(i);
@@ -472,15 +635,64 @@ class DomainTable :  DomainTableBase
 
 			//Donot reuse index for entity tables
 			if (!DO::IsEntity())
-				d_buffer_free.push_back(id%d_buffer_max); 
+				d_buffer_free.push_back(id%d_row_stride); 
 
 			deleteObjFromIndices(obj);
 			obj->notifyFieldUpdate(-1);
 			obj->~DO();
-			memset(&d_buffer[id%d_buffer_max], 0xFF, sizeof(DO));
+			tombstone(obj);
 			d_size--;
 			return true;
 		};
+
+		//Removes the objects in [first,last) of index. The range is erased from its index in one
+		//step. Other indices erase per object for small ranges, and are swept once for tombstones
+		//when the range is a large part of the table. Returns the number of objects removed.
+		int removeRange(Index * index, IndexIterator first, IndexIterator last)
+		{
+			if (index == NULL || first == last) return 0;
+			if (last != index->end() && index->key_comp()(*last, *first)) return 0;
+			int count = 0;
+			for (IndexIterator itr = first; itr != last; ++itr, ++count)
+				(*itr)->notifyFieldUpdate(-1);
+
+			bool sweep = count > d_size / 8;
+			for (IndexIterator itr = first; itr != last; ++itr)
+			{
+				DO * obj = *itr;
+				if (!sweep)
+					for ( IndexContainerIterator iter = d_indices.begin(); iter != d_indices.end(); ++iter)
+						if (iter->second != index) iter->second->erase(obj);
+				if (!DO::IsEntity())
+					d_buffer_free.push_back(obj->d_row % d_row_stride);
+				obj->~DO();
+				tombstone(obj);
+			}
+
+			if (sweep)
+			{
+				for ( IndexContainerIterator iter = d_indices.begin(); iter != d_indices.end(); ++iter)
+				{
+					if (iter->second == index) continue;
+					for (IndexIterator itr = iter->second->begin(); itr != iter->second->end(); )
+						if ((*itr)->d_row < 0) itr = iter->second->erase(itr);
+						else ++itr;
+				}
+			}
+			index->erase(first, last);
+			d_size -= count;
+			return count;
+		}
+
+		//Free slots are marked by d_row = -1. Debug builds poison the whole slot.
+		inline void tombstone(DO * obj)
+		{
+#ifndef NDEBUG
+			memset((void *)obj, 0xFF, sizeof(DO));
+#else
+			*(const_cast< int * >(&obj->d_row)) = -1;
+#endif
+		}
 		
 		bool checkIndex()
 		{
@@ -500,9 +712,11 @@ class DomainTable :  DomainTableBase
 
 		DO * getObject(int id) 
 		{
-			if (d_size == 0) return NULL;
-            int maxid = (d_buffer_loop+1)*d_buffer_max;
-			return ( id < 0 || id > maxid || d_buffer[id%d_buffer_max].d_row != id )? NULL:&d_buffer[id%d_buffer_max];
+			if (d_size == 0 || id < 0) return NULL;
+			int index = id % d_row_stride;
+			if (index >= d_buffer_max) return NULL;
+			DO * obj = slot(index);
+			return ( obj->d_row != id )? NULL:obj;
 		};
 		
 		int getObjectID(const DO * obj) 
@@ -510,10 +724,10 @@ class DomainTable :  DomainTableBase
 			//make sure memory offset and rowID match
 			if ( obj == NULL) return -1;
 			if (d_size == 0)  return -1;
-			if ((long long)obj < (long long)&d_buffer[0] || (long long)obj > (long long)&d_buffer[d_buffer_max-1])
-				return -1;
-			int index = ((long long)obj - (long long)&d_buffer[0]) / sizeof(DO);
-			return ( index < 0 || index > d_buffer_max || index != ((int)obj->d_row%d_buffer_max))? -1:(int)obj->d_row;
+			int row = obj->d_row;
+			if (row < 0) return -1;
+			int index = row % d_row_stride;
+			return ( index >= d_buffer_max || slot(index) != obj )? -1:row;
 		};
 
 
@@ -556,6 +770,121 @@ class DomainTable :  DomainTableBase
 
 };
 
+//Lightweight view over an index range, usable in range-for. Holds the index handle and the
+//resolved bounds, so it can be re-iterated without any lookups or allocation until the
+//table changes. The bounds are index iterators: an insert, delete or update of an indexed
+//field can leave them pointing at a removed node, so build a new range after a mutation.
+//Example: for (auto ord : db.range<Order>("BookIndex").prefix(key).reverse().limit(5))
+template <typename DO>
+class DomainRange
+{
+	public:
+		typedef typename DomainTable<DO>::Index 		Index;
+		typedef typename DomainTable<DO>::IndexIterator IndexIterator;
+
+		class iterator
+		{
+			friend DomainRange<DO>;
+
+			public:
+				iterator() : d_left(0), d_reverse(false) {}
+
+				//reverse iterators point one past the current record (like std::reverse_iterator)
+				DO * operator*() const 
+				{ 
+					if (!d_reverse) return *d_itr;
+					IndexIterator itr = d_itr;
+					return *(--itr);
+				}
+
+				iterator& operator++()
+				{
+					if (d_reverse) --d_itr; else ++d_itr;
+					--d_left;
+					return *this;
+				}
+
+				bool done() const { return d_left == 0 || d_itr == d_stop; }
+				bool operator==(const iterator &other) const 
+				{ 
+					return (done() && other.done()) || (!done() && !other.done() && d_itr == other.d_itr); 
+				}
+				bool operator!=(const iterator &other) const { return !(*this == other); }
+
+			private:
+				IndexIterator d_itr;
+				IndexIterator d_stop;
+				size_t 		  d_left;
+				bool 		  d_reverse;
+		};
+
+		DomainRange(Index * index) : d_index(index), d_limit(SIZE_MAX), d_reverse(false)
+		{
+			if (d_index == NULL) return;
+			d_first = d_index->begin();
+			d_last = d_index->end();
+		}
+
+		//first record not less than key on the index fields
+		DomainRange& from(DO &key)
+		{
+			if (d_index != NULL) d_first = bound(key, -1);
+			return *this;
+		}
+
+		//last record not greater than key on the index fields (inclusive)
+		DomainRange& to(DO &key)
+		{
+			if (d_index != NULL) d_last = bound(key, INT_MAX);
+			return *this;
+		}
+
+		//all records equal to key on the index fields, (eg) all rows for a
+		//leading key of an index ordered by (key, row)
+		DomainRange& prefix(DO &key)
+		{
+			return from(key).to(key);
+		}
+
+		DomainRange& limit(size_t count) { d_limit = count; return *this; }
+		DomainRange& reverse(bool rev = true) { d_reverse = rev; return *this; }
+
+		bool valid() const { return d_index != NULL; }
+		bool empty() const { return begin().done(); }
+		DO * front() const { return empty()? NULL:*begin(); }
+
+		iterator begin() const
+		{
+			iterator itr;
+			if (d_index == NULL) return itr;
+			itr.d_reverse = d_reverse;
+			itr.d_itr = d_reverse? d_last:d_first;
+			itr.d_stop = d_reverse? d_first:d_last;
+			//an inverted range (from > to) is empty
+			itr.d_left = (d_first == d_index->end() || (d_last != d_index->end() && 
+						d_index->key_comp()(*d_last, *d_first)))? 0:d_limit;
+			return itr;
+		}
+
+		iterator end() const { return iterator(); }
+
+	private:
+		//row sentinel makes the key sort before (-1) or after (INT_MAX) all records with equal fields
+		IndexIterator bound(DO &key, int row)
+		{
+			int saved = key.d_row;
+			*(const_cast< int * >(&key.d_row)) = row;
+			IndexIterator itr = (row < 0)? d_index->lower_bound(&key):d_index->upper_bound(&key);
+			*(const_cast< int * >(&key.d_row)) = saved;
+			return itr;
+		}
+
+		Index * 		d_index;
+		IndexIterator 	d_first;
+		IndexIterator 	d_last;
+		size_t 			d_limit;
+		bool 			d_reverse;
+};
 class DBChangeListener
 {
 	public:
@@ -573,13 +902,23 @@ class DomainDB
 		DomainTableBase * d_tables[MAX_TABLE_SIZE];
 		DomainLogger d_logger;
 		std::vector<DBChangeListener *> d_listeners;
+		MemPolicy d_mempolicy;
+		bool d_use_mempolicy;
+
+		void * allocBuffer(int size)
+		{
+			void * sBuf = NULL;
+			if (!d_use_mempolicy) return malloc(size);
+			iAllocMem(&sBuf, size, &d_mempolicy);
+			return sBuf;
+		}
 		
     public:
 
 		DomainDB(const DomainDB &) = delete; // Copy constructor.  
 		DomainDB& operator= (const DomainDB &) = delete; //copy assign
 		
-		DomainDB(uint32_t id) : d_DBID(id), d_trans(0), d_logger() {
+		DomainDB(uint32_t id) : d_DBID(id), d_trans(0), d_logger(), d_use_mempolicy(false) {
 			for (int i=0;i<MAX_TABLE_SIZE;i++)
 				d_tables[i] = nullptr;
 		}
@@ -601,12 +940,26 @@ class DomainDB
 			return *db;
 		}
 
+		//Allocation policy for table, index and logger buffers that are not passed in.
+		//Applies to tables and logger initialized after this call. False for an unsupported page size.
+		bool setMemPolicy(const MemPolicy &policy)
+		{
+			if (iCheckMemPolicy(&policy) < 0) return false;
+			d_mempolicy = policy;
+			d_use_mempolicy = true;
+			return true;
+		}
+
 		//Size is passed only during initialization
         DomainLogger& getLogger(void * sBuf = NULL, int size = 0) 
 		{ 
-			if ( size > 0 ) 
-				instance(d_DBID).d_logger.setBuffer(sBuf,size);
-			return instance(d_DBID).d_logger;
+			if ( size > 0 && d_logger.d_buffer == nullptr )
+			{
+				if ( sBuf == nullptr )
+					sBuf = allocBuffer(size);
+				d_logger.setBuffer(sBuf,size);
+			}
+			return d_logger;
 		}
 
 		void addDBChangeListener(DBChangeListener * listener)
@@ -641,6 +994,14 @@ class DomainDB
 			return d_tables[tableID]->removeObject(row);
 		}
 
+		//applies a batch of row mutations of one table, recs may get reordered by row.
+		//returns the number of mutations applied (-1 for unknown table)
+		int applyBatch(int tableID, RowMutation * recs, int count)
+		{
+			if (d_tables[tableID] == nullptr) return -1;
+			return d_tables[tableID]->applyBatch(recs, count);
+		}
+
         bool setRow(const std::string &data)
 		{
 			for (int i=0;i<MAX_TABLE_SIZE;i++)
@@ -772,13 +1133,8 @@ class DomainDB
         	auto rc = iterator<DO>(start_itr,end_itr, index_name, start_key, end_key);
         	if (rc < 0) return rc;
 
-        	//delete in 2 steps
-            std::vector<int32_t> vec;
-			for (;start_itr != end_itr; ++start_itr) 
-				vec.push_back((*start_itr)->d_row);
-			for (auto idx: vec) deleteByIndex<DO>(idx);
-
-            return vec.size();
+            DomainTable<DO> &table = DomainDB::instance(d_DBID).getTable<DO>();
+            return table.removeRange(table.getIndex(index_name), start_itr, end_itr);
         }
 
         template <typename DO>
@@ -795,6 +1151,12 @@ class DomainDB
 			return table.checkIndex();
 		}
 
+        template <typename DO>
+        bool setTableGrowth(int maxsegments, segment_allocator allocator = NULL)
+        {
+            DomainTable<DO> &table = DomainDB::instance(d_DBID).getTable<DO>();
+            return table.setGrowth(maxsegments, allocator);
+        }
         template <typename DO>
         int32_t getRecordCount(const std::string indexName = "") const
         {
@@ -895,6 +1257,15 @@ class DomainDB
             return 0;
         }
 
+        //Range over an index, supports bounds, limit and reverse in range-for loops.
+        //Invalid index names return an empty range. Valid until the next change to the table.
+        template <typename DO>
+        DomainRange<DO> range(const std::string & index_name = "PrimaryKey")
+        {
+            DomainTable<DO> &table = DomainDB::instance(d_DBID).getTable<DO>();
+            return DomainRange<DO>(table.getIndex(index_name));
+        }
+
         //Returns begin iterator so as to use it for breaking reverse iteration loop
         //Example while (itrN != itr && itrN != itrB) itrN--;
         template <typename DO>
@@ -928,14 +1299,19 @@ class DomainDB
         template <typename DO> DomainTable<DO> & getTable(void * sBuf = NULL, int size = 0)
         {
 			if (d_tables[DO::TableID()] == NULL)
-				d_tables[DO::TableID()] = new DomainTable<DO>(d_DBID);
+			{
+				DomainTable<DO> * table = new DomainTable<DO>(d_DBID);
+				if (d_use_mempolicy) table->setMemPolicy(d_mempolicy);
+				d_tables[DO::TableID()] = table;
+			}
 
 			DomainTable<DO> * table = static_cast< DomainTable<DO> * > (d_tables[DO::TableID()]);
-			if ( size > 0 )
+			if ( size > 0 && table->d_segment_count == 0 )
             {
                 if ( sBuf == nullptr )
-                    sBuf = malloc(size);
-                table->setBuffer(sBuf, size);
+                    sBuf = allocBuffer(size);
+                if ( sBuf != nullptr )
+                    table->setBuffer(sBuf, size);
             }
 			return *table;		
         }
@@ -0,0 +1,355 @@
+#include "IoUring.hpp"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params * p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void * arg, unsigned nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, const void * arg, size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+IoUring::IoUring() : ring_fd(-1), sq_ring(MAP_FAILED), cq_ring(MAP_FAILED), sq_ring_size(0),
+    cq_ring_size(0), sqes((struct io_uring_sqe *) MAP_FAILED), sqes_size(0), sq_head(NULL),
+    sq_tail(NULL), sq_mask(NULL), sq_array(NULL), sq_entries(0), cq_head(NULL), cq_tail(NULL),
+    cq_mask(NULL), cqes(NULL), to_submit(0), buffers(NULL), buf_count(0), buf_size(0)
+{
+}
+
+IoUring::~IoUring()
+{
+    release();
+}
+
+void IoUring::release()
+{
+    if (buffers != NULL) free(buffers);
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+    if (ring_fd >= 0) close(ring_fd);
+    ring_fd = -1;
+    sq_ring = cq_ring = MAP_FAILED;
+    sqes = (struct io_uring_sqe *) MAP_FAILED;
+    buffers = NULL;
+}
+
+int32_t IoUring::init(unsigned entries, unsigned bufCount, unsigned bufSize)
+{
+    if (ring_fd >= 0) return 0;
+    if (bufCount == 0 || bufCount > 32768)
+        return IO_URING_ERROR_BUFFERS;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if ((ring_fd = sys_io_uring_setup(entries, &p)) < 0)
+    {
+        ring_fd = -1;
+        return IO_URING_ERROR_SETUP;
+    }
+    if (!(p.features & IORING_FEAT_EXT_ARG))
+    {
+        release();
+        return IO_URING_ERROR_NOSUPPORT;
+    }
+
+    sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        release();
+        return IO_URING_ERROR_MMAP;
+    }
+    cq_ring = (p.features & IORING_FEAT_SINGLE_MMAP)? sq_ring:
+        mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *) mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        release();
+        return IO_URING_ERROR_MMAP;
+    }
+
+    char * sq = (char *) sq_ring;
+    char * cq = (char *) cq_ring;
+    sq_head  = (unsigned *) (sq + p.sq_off.head);
+    sq_tail  = (unsigned *) (sq + p.sq_off.tail);
+    sq_mask  = (unsigned *) (sq + p.sq_off.ring_mask);
+    sq_array = (unsigned *) (sq + p.sq_off.array);
+    sq_entries = p.sq_entries;
+    cq_head  = (unsigned *) (cq + p.cq_off.head);
+    cq_tail  = (unsigned *) (cq + p.cq_off.tail);
+    cq_mask  = (unsigned *) (cq + p.cq_off.ring_mask);
+    cqes     = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    //receive buffers, all handed to the kernel with one request
+    buf_count = bufCount;
+    buf_size  = bufSize;
+    if ((buffers = (char *) malloc((size_t)bufCount * bufSize)) == NULL)
+    {
+        release();
+        return IO_URING_ERROR_BUFFERS;
+    }
+    memset(buffers, 0, (size_t)bufCount * bufSize);
+
+    struct io_uring_sqe * sqe = nextSqe();
+    provide(sqe, 0, bufCount);
+    sqe->flags = 0;
+    IoCompletion done;
+    if (submit(-1) < 0 || reap(&done, 1) != 1 || done.res < 0 || !probe())
+    {
+        release();
+        return IO_URING_ERROR_NOSUPPORT;
+    }
+    return 0;
+}
+
+//The ring itself works from 5.11 (EXT_ARG), but the event loop also needs
+//IOSQE_CQE_SKIP_SUCCESS (5.17) and multishot receive (6.0). Older kernels fail those
+//requests with -EINVAL only once sessions use them, so try them here.
+bool IoUring::probe()
+{
+    static const uint64_t PROBE_SKIP = ~0ULL, PROBE_NOP = ~0ULL - 1, PROBE_RECV = ~0ULL - 2;
+    static const uint8_t ops[] = { IORING_OP_NOP, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_POLL_ADD,
+                                   IORING_OP_ASYNC_CANCEL, IORING_OP_PROVIDE_BUFFERS };
+    const unsigned nops = 256;
+    std::vector<char> mem(sizeof(struct io_uring_probe) + nops * sizeof(struct io_uring_probe_op), 0);
+    struct io_uring_probe * supported = (struct io_uring_probe *) &mem[0];
+    if (sys_io_uring_register(ring_fd, IORING_REGISTER_PROBE, supported, nops) < 0)
+        return false;
+    for (size_t ii = 0; ii < sizeof(ops); ii++)
+        if (ops[ii] > supported->last_op || !(supported->ops[ops[ii]].flags & IO_URING_OP_SUPPORTED))
+            return false;
+
+    //an unknown sqe flag fails the request, so a skipped nop shows up as a completion
+    struct io_uring_sqe * sqe;
+    IoCompletion done[2];
+    if ((sqe = nextSqe()) == NULL) return false;
+    sqe->opcode    = IORING_OP_NOP;
+    sqe->flags     = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = PROBE_SKIP;
+    if ((sqe = nextSqe()) == NULL) return false;
+    sqe->opcode    = IORING_OP_NOP;
+    sqe->user_data = PROBE_NOP;
+    if (submit(-1) < 0 || reap(done, 2) != 1 || done[0].user_data != PROBE_NOP)
+        return false;
+
+    //multishot receive keeps the request armed (F_MORE) after the first msg
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) return false;
+    bool ok = recvMultishot(fds[0], PROBE_RECV) == 0 && submit(0) >= 0 && write(fds[1], "x", 1) == 1 &&
+              waitFor(PROBE_RECV, done[0]) && done[0].res == 1;
+    bool multishot = ok && hasMore(done[0].flags), armed = multishot;
+    if (ok && hasBuffer(done[0].flags)) releaseBuffer(bufferId(done[0].flags));
+    //the peer closing ends the receive with a final completion
+    shutdown(fds[1], SHUT_WR);
+    while (armed && waitFor(PROBE_RECV, done[0]))
+    {
+        if (hasBuffer(done[0].flags)) releaseBuffer(bufferId(done[0].flags));
+        armed = hasMore(done[0].flags);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return multishot && !armed && submit(0) >= 0;
+}
+
+//reaps until the completion for user_data, waiting upto a second
+bool IoUring::waitFor(uint64_t user_data, IoCompletion & done)
+{
+    for (int tries = 0; tries < 10; )
+    {
+        if (reap(&done, 1) == 1)
+        {
+            if (done.user_data == user_data) return true;
+            continue;
+        }
+        if (submit(100) < 0) return false;
+        tries++;
+    }
+    return false;
+}
+
+void IoUring::provide(struct io_uring_sqe * sqe, uint16_t bid, unsigned count)
+{
+    sqe->opcode    = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd        = (int) count;
+    sqe->addr      = (uint64_t)(uintptr_t) buffer(bid);
+    sqe->len       = buf_size;
+    sqe->off       = bid;
+    sqe->buf_group = 0;
+    sqe->flags     = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = 0;
+}
+
+void IoUring::releaseBuffer(uint16_t bid)
+{
+    struct io_uring_sqe * sqe = nextSqe();
+    if (sqe == NULL)
+        deferred.push_back(bid);
+    else
+        provide(sqe, bid, 1);
+}
+
+struct io_uring_sqe * IoUring::nextSqe()
+{
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *sq_tail;
+    if (tail - head >= sq_entries)
+    {
+        //flush what is queued to make room
+        if (submit(0) < 0) return NULL;
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= sq_entries) return NULL;
+    }
+    unsigned idx = tail & *sq_mask;
+    struct io_uring_sqe * sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[idx] = idx;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++to_submit;
+    return sqe;
+}
+
+int32_t IoUring::recvMultishot(int fd, uint64_t user_data)
+{
+    struct io_uring_sqe * sqe = nextSqe();
+    if (sqe == NULL) return IO_URING_ERROR_FULL;
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = fd;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int32_t IoUring::send(int fd, const void * buf, size_t len, uint64_t user_data)
+{
+    struct io_uring_sqe * sqe = nextSqe();
+    if (sqe == NULL) return IO_URING_ERROR_FULL;
+    sqe->opcode    = IORING_OP_SEND;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)(uintptr_t) buf;
+    sqe->len       = (uint32_t) len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int32_t IoUring::pollMultishot(int fd, uint64_t user_data)
+{
+    struct io_uring_sqe * sqe = nextSqe();
+    if (sqe == NULL) return IO_URING_ERROR_FULL;
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len           = IORING_POLL_ADD_MULTI;
+    sqe->user_data     = user_data;
+    return 0;
+}
+
+int32_t IoUring::cancel(uint64_t user_data)
+{
+    struct io_uring_sqe * sqe = nextSqe();
+    if (sqe == NULL) return IO_URING_ERROR_FULL;
+    sqe->opcode       = IORING_OP_ASYNC_CANCEL;
+    sqe->fd           = -1;
+    sqe->addr         = user_data;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data    = 0;
+    return 0;
+}
+
+int32_t IoUring::submit(int wait_ms)
+{
+    unsigned flags = 0, min_complete = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    const void * argp = NULL;
+    size_t argsz = 0;
+    if (wait_ms != 0)
+    {
+        flags = IORING_ENTER_GETEVENTS;
+        min_complete = 1;
+        if (wait_ms > 0)
+        {
+            ts.tv_sec  = wait_ms / 1000;
+            ts.tv_nsec = (wait_ms % 1000) * 1000000L;
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (uint64_t)(uintptr_t) &ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof(arg);
+        }
+    }
+    //buffers released while the submission queue was full
+    while (!deferred.empty() && (sq_entries - (*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE))) > 0)
+    {
+        provide(nextSqe(), deferred.back(), 1);
+        deferred.pop_back();
+    }
+    if (to_submit == 0 && min_complete == 0) return 0;
+
+    int iRC;
+    while ((iRC = sys_io_uring_enter(ring_fd, to_submit, min_complete, flags, argp, argsz)) < 0)
+    {
+        //timeout or signal while waiting is not an error
+        if (errno == ETIME || errno == EINTR) { iRC = 0; break; }
+        if (errno != EAGAIN && errno != EBUSY) return IO_URING_ERROR_SUBMIT;
+    }
+    to_submit -= std::min((unsigned) iRC, to_submit);
+    return iRC;
+}
+
+unsigned IoUring::reap(IoCompletion * out, unsigned max)
+{
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    unsigned count = 0;
+    for (; head != tail && count < max; ++head, ++count)
+    {
+        struct io_uring_cqe * cqe = &cqes[head & *cq_mask];
+        out[count].user_data = cqe->user_data;
+        out[count].res       = cqe->res;
+        out[count].flags     = cqe->flags;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+bool IoUring::hasBuffer(uint32_t flags)
+{
+    return (flags & IORING_CQE_F_BUFFER) != 0;
+}
+
+uint16_t IoUring::bufferId(uint32_t flags)
+{
+    return (uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+bool IoUring::hasMore(uint32_t flags)
+{
+    return (flags & IORING_CQE_F_MORE) != 0;
+}
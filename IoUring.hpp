@@ -0,0 +1,106 @@
+#ifndef _IO_URING_HPP_
+#define _IO_URING_HPP_
+
+/**
+ * \brief Minimal io_uring wrapper on raw syscalls (no liburing)
+ *
+ * \details Single issuer ring for the socket event loop
+ *          init - setup the ring and the provided buffers (group 0) for receives
+ *          recvMultishot - one request keeps receiving into provided buffers
+ *          send / pollMultishot / cancel - queue requests
+ *          submit - one io_uring_enter for everything queued, optionally waiting
+ *          reap - drain completions, receive buffers go back with releaseBuffer
+ *
+ *          Buffers are given back with IORING_OP_PROVIDE_BUFFERS requests that ride
+ *          along with the next submit. Needs kernel 6.0+ (multishot receive).
+ *          init tries the requests the loop depends on and fails with
+ *          IO_URING_ERROR_NOSUPPORT on older kernels so callers can fall back.
+ */
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+struct IoCompletion
+{
+    uint64_t user_data;
+    int32_t  res;
+    uint32_t flags;
+};
+
+//Error codes
+static const int32_t IO_URING_ERROR_SETUP     = -1;
+static const int32_t IO_URING_ERROR_MMAP      = -2;
+static const int32_t IO_URING_ERROR_BUFFERS   = -3;
+static const int32_t IO_URING_ERROR_FULL      = -4;
+static const int32_t IO_URING_ERROR_SUBMIT    = -5;
+static const int32_t IO_URING_ERROR_NOSUPPORT = -6;
+
+class IoUring
+{
+    public:
+        IoUring();
+        ~IoUring();
+
+        //entries is the submission queue size, bufCount buffers of bufSize
+        //bytes are provided to the kernel for receives. Returns 0 or IO_URING_ERROR_*
+        int32_t init(unsigned entries, unsigned bufCount, unsigned bufSize);
+        bool ready() const { return ring_fd >= 0; }
+
+        int32_t recvMultishot(int fd, uint64_t user_data);
+        int32_t send(int fd, const void * buf, size_t len, uint64_t user_data);
+        int32_t pollMultishot(int fd, uint64_t user_data);
+        int32_t cancel(uint64_t user_data);
+
+        //submits the queued requests. wait_ms < 0 blocks for a completion, 0 does not wait.
+        //Returns the number submitted or IO_URING_ERROR_SUBMIT
+        int32_t submit(int wait_ms = 0);
+        unsigned pending() const { return to_submit; }
+
+        //copies upto max completions and advances the completion queue
+        unsigned reap(IoCompletion * out, unsigned max);
+
+        static bool hasBuffer(uint32_t flags);
+        static uint16_t bufferId(uint32_t flags);
+        static bool hasMore(uint32_t flags);
+        char * buffer(uint16_t bid) const { return buffers + (size_t)bid * buf_size; }
+        //gives a receive buffer back to the kernel with the next submit
+        void releaseBuffer(uint16_t bid);
+
+    private:
+        IoUring& operator=(const IoUring &);     //assigment op
+        IoUring(const IoUring &);                //copy constructor
+
+        struct io_uring_sqe * nextSqe();
+        void provide(struct io_uring_sqe * sqe, uint16_t bid, unsigned count);
+        void release();
+        bool probe();
+        bool waitFor(uint64_t user_data, IoCompletion & done);
+
+        int ring_fd;
+        void * sq_ring;
+        void * cq_ring;
+        size_t sq_ring_size;
+        size_t cq_ring_size;
+        struct io_uring_sqe * sqes;
+        size_t sqes_size;
+
+        unsigned * sq_head;
+        unsigned * sq_tail;
+        unsigned * sq_mask;
+        unsigned * sq_array;
+        unsigned sq_entries;
+        unsigned * cq_head;
+        unsigned * cq_tail;
+        unsigned * cq_mask;
+        struct io_uring_cqe * cqes;
+        unsigned to_submit;
+
+        //provided buffers (group 0)
+        char * buffers;
+        unsigned buf_count;
+        unsigned buf_size;
+        std::vector<uint16_t> deferred;
+};
+
+#endif
@@ -15,6 +15,7 @@
  */
 
 #include "ProducerConsumerQueue.hpp"
+#include "Containers.hpp"
 
 #include <atomic>
 #include <chrono>
@@ -39,9 +40,20 @@ namespace {
     std::string generate() const { return std::string(12, ' '); }
   };
 
+  // plain new only aligns to 16 bytes before C++17, the queues are cache line aligned
+  template<class T> struct AlignedDelete {
+    void operator()(T* p) const { p->~T(); free(p); }
+  };
+  template<class T, class... Args>
+  std::unique_ptr<T, AlignedDelete<T> > makeAligned(Args&&... args) {
+    void* p;
+    if (posix_memalign(&p, CACHE_LINE_SIZE, sizeof(T)) != 0) throw std::bad_alloc();
+    return std::unique_ptr<T, AlignedDelete<T> >(new (p) T(std::forward<Args>(args)...));
+  }
+
   template<class TestType> void doTest(const char* name) {
     std::cout << "  testing: " << name << std::endl;
-    std::unique_ptr<TestType> const t(new TestType());
+    auto const t = makeAligned<TestType>();
     (*t)();
   }
 
@@ -98,6 +110,139 @@ struct PerfTest {
 };
 
 
+// Gives the push/pop queues of Containers.hpp the write/read interface of PerfTest
+template<class QueueType>
+struct PushPopAdapter {
+  typedef typename QueueType::value_type value_type;
+
+  explicit PushPopAdapter(size_t) : held_(false) {}
+  bool write(const value_type& v) { return queue_.push(v); }
+  bool read(value_type& v) { return queue_.pop(v); }
+  value_type* frontPtr() {
+    return (held_ || (held_ = queue_.pop(front_))) ? &front_ : nullptr;
+  }
+  void popFront() { held_ = false; }
+
+  QueueType queue_;
+  value_type front_;
+  bool held_;
+};
+
+template<class T> struct SPSCQueueOf : SPSCQueue<T,0xfffe> { typedef T value_type; };
+
+// ZeroOneQueue hands out indices into an external buffer, synchronized through the slot flags
+template<class T, size_t N>
+struct ZeroOneAdapter {
+  typedef T value_type;
+
+  explicit ZeroOneAdapter(size_t) {}
+  bool write(const T& v) {
+    if (queue_.isFull()) return false;
+    uint32_t index;
+    queue_.getWritePos(index);
+    data_[index] = v;
+    queue_.advance_write_ptr();
+    return true;
+  }
+  bool read(T& v) {
+    T* front = frontPtr();
+    if (!front) return false;
+    v = *front;
+    popFront();
+    return true;
+  }
+  T* frontPtr() {
+    if (queue_.isEmpty()) return nullptr;
+    uint32_t index;
+    queue_.getReadPos(index);
+    return &data_[index];
+  }
+  void popFront() { queue_.advance_read_ptr(); }
+
+  ZeroOneQueue<N> queue_;
+  T data_[N];
+};
+
+// Round trip of a timestamp through a ping and a pong queue, reports the one way latency
+template<class QueueType>
+struct LatencyTest {
+  explicit LatencyTest() : ping_(0xfffe), pong_(0xfffe) {}
+
+  void operator()() {
+    using namespace std::chrono;
+    const int count = 1 << 14;
+    std::thread echo([this, count] {
+      for (int i = 0; i < count; ++i) {
+        uint64_t ts;
+        while (!ping_.read(ts)) { std::this_thread::yield(); }
+        while (!pong_.write(ts)) { std::this_thread::yield(); }
+      }
+    });
+
+    uint64_t total = 0;
+    for (int i = 0; i < count; ++i) {
+      uint64_t ts = duration_cast<nanoseconds>(
+        steady_clock::now().time_since_epoch()).count();
+      while (!ping_.write(ts)) { std::this_thread::yield(); }
+      while (!pong_.read(ts)) { std::this_thread::yield(); }
+      total += duration_cast<nanoseconds>(
+        steady_clock::now().time_since_epoch()).count() - ts;
+    }
+    echo.join();
+    std::cout << "     one way: " << total / count / 2 << " ns" << std::endl;
+  }
+
+  QueueType ping_;
+  QueueType pong_;
+};
+
+// Same as PerfTest, but moves the data in batches through push_n/pop_n
+template<class QueueType, size_t Batch>
+struct BatchPerfTest {
+  typedef typename QueueType::value_type T;
+
+  explicit BatchPerfTest() : done_(false) {}
+
+  void operator()() {
+    using namespace std::chrono;
+    auto const startTime = system_clock::now();
+    std::thread producer([this] { this->producer(); });
+    std::thread consumer([this] { this->consumer(); });
+
+    producer.join();
+    done_ = true;
+    consumer.join();
+
+    auto duration = duration_cast<milliseconds>(
+      system_clock::now() - startTime);
+    std::cout << "     done: " << duration.count() << " ms" << std::endl;
+  }
+
+  void producer() {
+    T data[Batch];
+    for (auto i = traits_.limit(); i > 0; i -= Batch) {
+      for (size_t j = 0; j < Batch; ++j) {
+        data[j] = traits_.generate();
+      }
+      size_t sent = 0;
+      while (sent < Batch) {
+        sent += queue_.push_n(data + sent, Batch - sent);
+      }
+    }
+  }
+
+  void consumer() {
+    T data[Batch];
+    while (!done_) {
+      queue_.pop_n(data, Batch);
+    }
+  }
+
+  QueueType queue_;
+  std::atomic<bool> done_;
+  TestTraits<T> traits_;
+};
+
 template<class T, bool Pop = false>
 void perfTestType(const char* type) {
   const size_t size = 0xfffe;
@@ -107,6 +252,18 @@ void perfTestType(const char* type) {
     "ProducerConsumerQueue");
 }
 
+template<class T>
+void spscPerfTestType(const char* type) {
+  const size_t size = 0xfffe;
+
+  std::cout << "Type: " << type;
+  doTest<PerfTest<PushPopAdapter<SPSCQueueOf<T> >,size> >("SPSCQueue");
+  std::cout << "Type: " << type;
+  doTest<PerfTest<PushPopAdapter<SPSCRing<T,0x10000> >,size> >("SPSCRing");
+  std::cout << "Type: " << type;
+  doTest<BatchPerfTest<SPSCRing<T,0x10000>,32> >("SPSCRing push_n/pop_n");
+}
+
 template<class QueueType, size_t Size, bool Pop>
 struct CorrectnessTest {
   typedef typename QueueType::value_type T;
@@ -227,6 +384,9 @@ TEST_F(PCQ, PerfTest) {
   perfTestType<std::string>("string");
   perfTestType<int>("int");
   perfTestType<unsigned long long>("unsigned long long");
+  spscPerfTestType<std::string>("string");
+  spscPerfTestType<int>("int");
+  spscPerfTestType<unsigned long long>("unsigned long long");
 }
 
 TEST_F(PCQ, Destructor) {
@@ -270,6 +430,75 @@ TEST_F(PCQ, Destructor) {
   EXPECT_EQ(DtorChecker::numInstances, (const unsigned long)0);
 }
 
+TEST_F(PCQ, LatencyTest) {
+  doTest<LatencyTest<ProducerConsumerQueue<uint64_t> > >("ProducerConsumerQueue");
+  doTest<LatencyTest<PushPopAdapter<SPSCQueueOf<uint64_t> > > >("SPSCQueue");
+  doTest<LatencyTest<PushPopAdapter<SPSCRing<uint64_t,0x10000> > > >("SPSCRing");
+  doTest<LatencyTest<ZeroOneAdapter<uint64_t,0x10000> > >("ZeroOneQueue");
+}
+
+TEST_F(PCQ, ZeroOneQueueCorrectness) {
+
+  doTest<CorrectnessTest<ZeroOneAdapter<int,0x10000>,0x10000,false> >("ZeroOneQueue");
+
+  // batch advance on both sides
+  auto q = makeAligned<ZeroOneAdapter<int,64> >(0);
+  const int count = 1 << 14;
+  std::thread producer([&q] {
+    for (int i = 0; i < count; ) {
+      size_t n = q->queue_.getCount_w(std::min(13, count - i));
+      uint32_t index;
+      q->queue_.getWritePos(index);
+      for (size_t j = 0; j < n; ++j) q->data_[(index + j) % 64] = i + j;
+      q->queue_.advance_write_ptr_by(n);
+      i += n;
+    }
+  });
+  for (int expect = 0; expect < count; ) {
+    size_t n = q->queue_.getCount_r(9);
+    uint32_t index;
+    q->queue_.getReadPos(index);
+    for (size_t j = 0; j < n; ++j) {
+      ASSERT_EQ(expect++, q->data_[(index + j) % 64]);
+    }
+    q->queue_.advance_read_ptr_by(n);
+  }
+  producer.join();
+  EXPECT_TRUE(q->queue_.isEmpty());
+}
+
+TEST_F(PCQ, SPSCRingCorrectness) {
+  auto ring = makeAligned<SPSCRing<int,1024> >();
+  const int count = 1 << 18;
+  std::thread producer([&ring] {
+    int data[7];
+    for (int i = 0; i < count; ) {
+      if (i % 3 == 0) {
+        while (!ring->push(i)) {}
+        ++i;
+        continue;
+      }
+      int n = std::min(7, count - i);
+      for (int j = 0; j < n; ++j) data[j] = i + j;
+      i += ring->push_n(data, n);
+    }
+  });
+
+  int expect = 0, data[5];
+  while (expect < count) {
+    size_t n = ring->pop_n(data, 5);
+    for (size_t j = 0; j < n; ++j) {
+      ASSERT_EQ(expect++, data[j]);
+    }
+    int v;
+    if (ring->pop(v)) {
+      ASSERT_EQ(expect++, v);
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(ring->empty());
+}
+
 TEST_F(PCQ, EmptyFull) {
   ProducerConsumerQueue<int> queue(3);
   EXPECT_TRUE(queue.isEmpty());
@@ -285,6 +514,159 @@ TEST_F(PCQ, EmptyFull) {
 
   EXPECT_FALSE(queue.write(3));
   EXPECT_EQ(queue.sizeGuess(), (const unsigned long)2);
+
+  SPSCRing<int,4> ring;
+  EXPECT_TRUE(ring.empty());
+  int data[6] = {1, 2, 3, 4, 5, 6};
+  EXPECT_EQ(ring.push_n(data, 6), (size_t)4);
+  EXPECT_TRUE(ring.full());
+  EXPECT_FALSE(ring.push(5));
+  EXPECT_EQ(ring.pop_n(data, 3), (size_t)3);
+  EXPECT_EQ(data[2], 3);
+  EXPECT_EQ(ring.size(), (size_t)1);
+
+  ZeroOneQueue<2> zq;
+  EXPECT_TRUE(zq.isEmpty());
+  EXPECT_FALSE(zq.isFull());
+  zq.advance_write_ptr_by(2);
+  EXPECT_TRUE(zq.isFull());  // all slots usable
+  EXPECT_EQ(zq.getCount_r(), (size_t)2);
+  zq.advance_read_ptr();
+  EXPECT_EQ(zq.getCount_w(), (size_t)1);
+}
+
+TEST_F(PCQ, RingBufferSPMCBatch) {
+  //room for the count and 8 stamped elements
+  std::vector<uint64_t> buf(1 + 8 * 2);
+  RingBufferSPMC<uint64_t> ring;
+  ring.setBuffer(&buf[0], buf.size() * sizeof(uint64_t));
+  EXPECT_EQ(ring.capacity(), (size_t)8);
+
+  RingBufferSPMC<uint64_t>::Claim c;
+  EXPECT_EQ(ring.claim(0, 4, c), (size_t)0);
+  for (uint64_t i = 0; i < 6; ++i) ring.write(i);
+  EXPECT_EQ(ring.claim(2, 16, c), (size_t)4);
+  EXPECT_EQ(c.first_count, (size_t)4);
+  EXPECT_EQ(c[3], (size_t)5);
+  EXPECT_EQ(ring.lapped(c), (size_t)0);
+
+  //wraps into two spans, the slot under the writer is never handed out
+  for (uint64_t i = 6; i < 12; ++i) ring.write(i);
+  EXPECT_EQ(ring.claim(0, 16, c), (size_t)7);
+  EXPECT_EQ(c.start, (size_t)5);
+  EXPECT_EQ(c.overrun, (size_t)5);
+  EXPECT_EQ(c.first_count, (size_t)3);
+  EXPECT_EQ(c.second_count, (size_t)4);
+  for (size_t i = 0; i < c.size(); ++i) EXPECT_EQ(c[i], c.start + i);
+
+  //writer laps the claim before it is consumed, 13 overwrites the slot of 5
+  ring.write(12);
+  ring.write(13);
+  EXPECT_EQ(ring.lapped(c), (size_t)1);
+
+  uint64_t items[16], res = 0, overrun = 0;
+  EXPECT_EQ(ring.read_n(items, 16, 10, res, overrun), (size_t)4);
+  EXPECT_EQ(res, (size_t)10);
+  EXPECT_EQ(overrun, (size_t)0);
+  EXPECT_EQ(items[3], (size_t)13);
+  EXPECT_EQ(ring.read_n(items, 16, 14, res, overrun), (size_t)0);
+
+  //a reader attached to the same memory (another process) sees the stamped slots
+  RingBufferSPMC<uint64_t> attached;
+  attached.setBuffer(&buf[0], buf.size() * sizeof(uint64_t), false);
+  EXPECT_EQ(attached.end(), (size_t)14);
+  uint64_t v = 0;
+  EXPECT_EQ(attached.tryRead(v, 13), RING_READ_OK);
+  EXPECT_EQ(v, (size_t)13);
+  EXPECT_EQ(attached.tryRead(v, 14), RING_READ_EMPTY);
+  EXPECT_EQ(attached.tryRead(v, 5), RING_READ_OVERRUN);
+  EXPECT_TRUE(attached.read(v, 0, res));
+  EXPECT_EQ(res, (size_t)7);
+  EXPECT_EQ(v, (size_t)7);
+}
+
+TEST_F(PCQ, RingBufferSPMCConsumers) {
+  struct Rec { uint64_t a, b; };
+  std::vector<uint64_t> buf(1 + 64 * 3);
+  RingBufferSPMC<Rec> ring;
+  ring.setBuffer(&buf[0], buf.size() * sizeof(uint64_t));
+  const uint64_t count = 1 << 16;
+  std::atomic<bool> done(false);
+
+  auto consume = [&ring, &done, count] {
+    Rec items[16];
+    uint64_t next = 0, res = 0, overrun = 0, lost = 0, seen = 0;
+    while (next < count) {
+      size_t n = ring.read_n(items, 16, next, res, overrun);
+      if (n == 0) {
+        if (done.load() && ring.end() <= next) break;
+        std::this_thread::yield();
+        continue;
+      }
+      lost += overrun;
+      for (size_t i = 0; i < n; ++i) {
+        ASSERT_EQ(res + i, items[i].a);
+        ASSERT_EQ(items[i].a, items[i].b);
+      }
+      seen += n;
+      next = res + n;
+    }
+    EXPECT_EQ(seen + lost, count);
+  };
+  auto single = [&ring, &done, count] {
+    Rec item;
+    uint64_t next = 0, res = 0;
+    while (next < count) {
+      if (!ring.read(item, next, res)) {
+        if (done.load() && ring.end() <= next) break;
+        std::this_thread::yield();
+        continue;
+      }
+      ASSERT_GE(res, next);
+      ASSERT_EQ(res, item.a);
+      ASSERT_EQ(item.a, item.b);
+      next = res + 1;
+    }
+  };
+  std::thread c1(consume), c2(consume), c3(single);
+  for (uint64_t i = 0; i < count; ++i) {
+    Rec r = { i, i };
+    ring.write(r);
+    if (i % 256 == 0) std::this_thread::yield();
+  }
+  done = true;
+  c1.join();
+  c2.join();
+  c3.join();
+}
+
 }
 
-}
\ No newline at end of file
+TEST_F(PCQ, RingBufferSPMCAligned) {
+  //cache line records are placed on a line boundary after the stamps
+  struct alignas(64) Line { uint64_t seq; char pad[56]; };
+  std::vector<uint64_t> buf(1 + 4 * 9 + 8);
+  RingBufferSPMC<Line> ring;
+  ring.setBuffer(&buf[0], buf.size() * sizeof(uint64_t));
+  EXPECT_EQ(ring.capacity(), (size_t)4);
+
+  Line line;
+  memset(&line, 0, sizeof(line));
+  for (uint64_t i = 0; i < 6; ++i) {
+    line.seq = i;
+    ring.write(line);
+  }
+  RingBufferSPMC<Line>::Claim c;
+  EXPECT_EQ(ring.claim(0, 4, c), (size_t)3);
+  EXPECT_EQ(c.second_count, (size_t)2);
+  EXPECT_EQ((uintptr_t)c.first % alignof(Line), (uintptr_t)0);
+  EXPECT_EQ((uintptr_t)c.second % alignof(Line), (uintptr_t)0);
+  EXPECT_TRUE((const char *)(c.second + ring.capacity()) <= (const char *)(&buf[0] + buf.size()));
+  for (size_t i = 0; i < c.size(); ++i) EXPECT_EQ(c[i].seq, c.start + i);
+
+  RingBufferSPMC<Line> attached;
+  attached.setBuffer(&buf[0], buf.size() * sizeof(uint64_t), false);
+  uint64_t res = 0;
+  EXPECT_TRUE(attached.read(line, 5, res));
+  EXPECT_EQ(line.seq, (size_t)5);
+}
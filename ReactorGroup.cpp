@@ -0,0 +1,276 @@
+#include "ReactorGroup.hpp"
+#include "TcpUtils.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <unistd.h>
+#include <algorithm>
+
+ReactorGroup::ReactorGroup(const Config & config) : Settings(config), bRunning(false)
+{
+	iNextReactor = iNextPoll = 0;
+	if (Settings.iThreads < 1) Settings.iThreads = 1;
+	if (Settings.iThreads > iMaxReactors) Settings.iThreads = iMaxReactors;
+	if (Settings.iMaxMsgSize <= 0 || Settings.iMaxMsgSize > ReactorMsg::iMaxMsg)
+		Settings.iMaxMsgSize = ReactorMsg::iMaxMsg;
+
+	for (int ii = 0; ii < Settings.iThreads; ii++)
+	{
+		Reactor * pReactor = new Reactor();
+		pReactor->iIndex = ii;
+		pReactor->pSelector = NULL;
+		pReactor->iReady.store(0);
+		pReactor->iStatus = 0;
+		memset(&pReactor->Stats, 0, sizeof(ReactorStats));
+		memset(&pReactor->Loop, 0, sizeof(SelectorStats));
+		Reactors.push_back(pReactor);
+	}
+}
+
+ReactorGroup::~ReactorGroup()
+{
+	Stop();
+	for (size_t ii = 0; ii < Reactors.size(); ii++)
+		delete Reactors[ii];
+}
+
+int ReactorGroup::Start()
+{
+	if (bRunning.load()) return ux_selector::SUCCESS;
+	bRunning.store(true);
+	for (size_t ii = 0; ii < Reactors.size(); ii++)
+	{
+		Reactors[ii]->iReady.store(0);
+		Reactors[ii]->Thread = std::thread(&ReactorGroup::Run, this, Reactors[ii]);
+	}
+
+	//every reactor has to be listening before clients are let in
+	int iRC = ux_selector::SUCCESS;
+	for (size_t ii = 0; ii < Reactors.size(); ii++)
+	{
+		int iReady;
+		while ((iReady = Reactors[ii]->iReady.load(std::memory_order_acquire)) == 0)
+			sched_yield();
+		if (iReady < 0 && iRC == ux_selector::SUCCESS)
+			iRC = iReady;
+	}
+	if (iRC != ux_selector::SUCCESS)
+		Stop();
+	return iRC;
+}
+
+void ReactorGroup::Stop()
+{
+	if (!bRunning.load()) return;
+	bRunning.store(false, std::memory_order_release);
+	for (size_t ii = 0; ii < Reactors.size(); ii++)
+	{
+		Reactor * pReactor = Reactors[ii];
+		if (pReactor->Thread.joinable())
+			pReactor->Thread.join();
+		int iSocket;
+		while (pReactor->Handoff.pop(iSocket))
+			disconnectTCP(iSocket);
+		delete pReactor->pSelector;
+		pReactor->pSelector = NULL;
+	}
+}
+
+//applies the affinity and name to the calling reactor thread, returns the first failing errno
+int ReactorGroup::Configure(Reactor * pReactor)
+{
+	int iStatus = 0, iRC;
+	pthread_t handle = pthread_self();
+	if (!Settings.Cpus.empty())
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(Settings.Cpus[pReactor->iIndex % Settings.Cpus.size()], &cpus);
+		if ((iRC = pthread_setaffinity_np(handle, sizeof(cpus), &cpus)) != 0 && iStatus == 0)
+			iStatus = iRC;
+	}
+	if (!Settings.name.empty())
+	{
+		std::string name = Settings.name + "-" + std::to_string(pReactor->iIndex);
+		if ((iRC = pthread_setname_np(handle, name.substr(0, 15).c_str())) != 0 && iStatus == 0)
+			iStatus = iRC;
+	}
+	return iStatus;
+}
+
+void ReactorGroup::Run(Reactor * pReactor)
+{
+	pReactor->iStatus = Configure(pReactor);
+	//created on the reactor thread so its session memory is local to the pinned cpu
+	ux_selector * pSelector = new ux_selector(Settings.iPollTimeout, Settings.eBackend);
+	pSelector->setBackpressure(Settings.Output);
+	pReactor->pSelector = pSelector;
+
+	int iRC = ux_selector::SUCCESS;
+	if (Settings.eMode == ACCEPT_REUSEPORT || pReactor->iIndex == 0)
+		for (size_t ii = 0; ii < Ports.size() && iRC >= 0; ii++)
+			iRC = pSelector->AddServer(Ports[ii], Settings.eMode == ACCEPT_REUSEPORT);
+	pReactor->iReady.store((iRC < 0)? iRC: 1, std::memory_order_release);
+	if (iRC < 0) return;
+
+	int iSocket;
+	while (bRunning.load(std::memory_order_acquire))
+	{
+		while (pReactor->Handoff.pop(iSocket))
+			AddSession(pReactor, iSocket);
+		SendAll(pReactor);
+		pSelector->PollForSocketEvent();
+		AcceptAll(pReactor);
+		ReadAll(pReactor);
+		PublishStats(pReactor);
+	}
+}
+
+//The selector belongs to the reactor thread (Stop deletes it), other threads read the copy
+void ReactorGroup::PublishStats(Reactor * pReactor)
+{
+	SelectorStats Snapshot;
+	pReactor->pSelector->getStats(Snapshot);
+	StatPublish(Snapshot, pReactor->Loop);
+}
+
+void ReactorGroup::AcceptAll(Reactor * pReactor)
+{
+	int iRC, iPort, iSocket;
+	while ((iRC = pReactor->pSelector->Accept(iPort, iSocket)) != ux_selector::END_OF_SOCK_LIST)
+	{
+		if (iRC != ux_selector::SUCCESS) continue;
+		StatAdd(pReactor->Stats.iAccepted);
+		if (Settings.eMode == ACCEPT_HANDOFF)
+		{
+			int iTarget = iNextReactor++ % size();
+			if (iTarget != pReactor->iIndex && Reactors[iTarget]->Handoff.push(iSocket))
+			{
+				StatAdd(pReactor->Stats.iHandedOff);
+				continue;
+			}
+		}
+		AddSession(pReactor, iSocket);
+	}
+}
+
+void ReactorGroup::AddSession(Reactor * pReactor, int iSocket)
+{
+	SocketStreamerBase * pStreamer = (Settings.pFactory != NULL)?
+		Settings.pFactory->create(iSocket): new SocketStreamerBase(iSocket, Settings.iBufferSize);
+	int iClientID = pReactor->pSelector->AddClient(pStreamer, Settings.iMaxMsgSize, Settings.iHeaderSize, Settings.SkipNL);
+	if (iClientID < 0)
+	{
+		cout << "Reactor " << pReactor->iIndex << " has no session slot for " << iSocket << endl;
+		delete pStreamer;
+		disconnectTCP(iSocket);
+		return;
+	}
+	Notify(pReactor, iClientID, EVENT_CONNECT);
+}
+
+//Session events are never dropped, they wait here while the application queue is full
+void ReactorGroup::Notify(Reactor * pReactor, int iClientID, int iEvent)
+{
+	ReactorMsg msg;
+	msg.iReactor = pReactor->iIndex;
+	msg.iClientID = iClientID;
+	msg.iGeneration = pReactor->pSelector->getGeneration(iClientID);
+	msg.iEvent = iEvent;
+	msg.iMsgLen = 0;
+	if (!pReactor->Pending.empty() || !pReactor->ToApp.push(msg))
+		pReactor->Pending.push_back(msg);
+}
+
+//Reads until the sessions are drained or the application queue is full. What is left
+//stays in the streamers and sockets for the next pass.
+void ReactorGroup::ReadAll(Reactor * pReactor)
+{
+	while (!pReactor->Pending.empty() && pReactor->ToApp.push(pReactor->Pending.front()))
+		pReactor->Pending.pop_front();
+
+	int iRC, iMsgLen;
+	const char * pMsg;
+	ReactorMsg msg;
+	msg.iReactor = pReactor->iIndex;
+	msg.iEvent = EVENT_MSG;
+	while (true)
+	{
+		if (!pReactor->Pending.empty() || pReactor->ToApp.full())
+		{
+			StatAdd(pReactor->Stats.iAppQueueFull);
+			return;
+		}
+		if ((iRC = pReactor->pSelector->ReadView(msg.iClientID, pMsg, iMsgLen)) == ux_selector::END_OF_SOCK_LIST)
+			return;
+		msg.iGeneration = pReactor->pSelector->getGeneration(msg.iClientID);
+		if (iRC == ux_selector::DISCONNECT)
+			Notify(pReactor, msg.iClientID, EVENT_DISCONNECT);
+		else if (iRC == ux_selector::SUCCESS)
+		{
+			msg.iMsgLen = std::min(iMsgLen, (int) ReactorMsg::iMaxMsg);
+			memcpy(msg.sMsg, pMsg, msg.iMsgLen);
+			pReactor->ToApp.push(msg);
+			StatAdd(pReactor->Stats.iMsgsIn);
+		}
+	}
+}
+
+void ReactorGroup::SendAll(Reactor * pReactor)
+{
+	ReactorMsg msg;
+	while (pReactor->FromApp.pop(msg))
+	{
+		//the session closed while this was queued, the slot may have a new one by now
+		if (msg.iGeneration != pReactor->pSelector->getGeneration(msg.iClientID))
+		{
+			StatAdd(pReactor->Stats.iSendsDropped);
+			continue;
+		}
+		int iRC = pReactor->pSelector->Write(msg.iClientID, msg.sMsg, msg.iMsgLen);
+		if (iRC == ux_selector::SUCCESS)
+			StatAdd(pReactor->Stats.iMsgsOut);
+		else
+		{
+			StatAdd(pReactor->Stats.iSendsDropped);
+			if (iRC == ux_selector::DISCONNECT)
+				Notify(pReactor, msg.iClientID, EVENT_DISCONNECT);
+		}
+	}
+}
+
+int ReactorGroup::Poll(ReactorMsg * Msgs, int iMax)
+{
+	int iCount = 0;
+	for (int ii = 0; ii < size() && iCount < iMax; ii++)
+	{
+		Reactor * pReactor = Reactors[iNextPoll];
+		iNextPoll = (iNextPoll + 1) % size();
+		iCount += (int) pReactor->ToApp.pop_n(&Msgs[iCount], iMax - iCount);
+	}
+	return iCount;
+}
+
+int ReactorGroup::Send(int iReactor, int iClientID, unsigned iGeneration, const char * Msg, int MsgLen)
+{
+	if (iReactor < 0 || iReactor >= size() || MsgLen < 0 || MsgLen > ReactorMsg::iMaxMsg)
+		return ux_selector::FAILURE;
+	ReactorMsg msg;
+	msg.iReactor = iReactor;
+	msg.iClientID = iClientID;
+	msg.iGeneration = iGeneration;
+	msg.iEvent = EVENT_MSG;
+	msg.iMsgLen = MsgLen;
+	memcpy(msg.sMsg, Msg, MsgLen);
+	return Reactors[iReactor]->FromApp.push(msg)? ux_selector::SUCCESS: ux_selector::WOULD_BLOCK;
+}
+
+void ReactorGroup::getStats(int iReactor, ReactorStats & Snapshot) const
+{
+	StatSnapshot(Reactors[iReactor]->Stats, Snapshot);
+}
+
+void ReactorGroup::getStats(int iReactor, SelectorStats & Snapshot) const
+{
+	StatSnapshot(Reactors[iReactor]->Loop, Snapshot);
+}
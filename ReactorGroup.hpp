@@ -0,0 +1,156 @@
+#ifndef _REACTOR_GROUP_HPP_
+#define _REACTOR_GROUP_HPP_
+
+/**
+ * \brief N ux_selector threads sharing the sessions of a server
+ *
+ * \details Each reactor thread owns one ux_selector and only touches its own sessions.
+ *          ACCEPT_REUSEPORT - every reactor listens on the port (SO_REUSEPORT) and the
+ *                             kernel spreads the connections
+ *          ACCEPT_HANDOFF   - reactor 0 accepts and hands the sockets round robin to
+ *                             the reactors over SPSC queues
+ *
+ *          Msgs and session events reach the application through one SPSC queue per
+ *          reactor (Poll), replies go back through another (Send). A single application
+ *          thread polls and sends. When the application falls behind a reactor stops
+ *          reading, so the backlog stays in the socket buffers.
+ */
+
+#include "ux_selector.hh"
+#include "Containers.hpp"
+#include <atomic>
+#include <new>
+#include <thread>
+#include <deque>
+#include <string>
+#include <vector>
+
+//Creates the streamer of an accepted socket. Called from the reactor threads.
+class StreamerFactory
+{
+	public:
+		virtual ~StreamerFactory() {}
+		virtual SocketStreamerBase * create(int iSocket) = 0;
+};
+
+struct ReactorMsg
+{
+	static const int iMaxMsg = 1024;
+	int iReactor;
+	int iClientID;
+	unsigned iGeneration;   //session of the slot, see ux_selector::getGeneration
+	int iEvent;         //ReactorGroup::EVENT_*
+	int iMsgLen;
+	char sMsg[iMaxMsg];
+};
+
+//Per reactor counters, read with ReactorGroup::getStats from any thread
+struct ReactorStats
+{
+	uint64_t iAccepted;
+	uint64_t iHandedOff;        //sockets accepted here and passed to another reactor
+	uint64_t iMsgsIn;           //msgs queued to the application
+	uint64_t iMsgsOut;          //msgs the application sent
+	uint64_t iSendsDropped;     //sends refused by the session (see Config::Output) or for a closed one
+	uint64_t iAppQueueFull;     //passes that stopped reading because the application lagged
+};
+
+class ReactorGroup
+{
+	public:
+		enum AcceptMode { ACCEPT_REUSEPORT, ACCEPT_HANDOFF };
+		enum Event { EVENT_CONNECT, EVENT_MSG, EVENT_DISCONNECT };
+
+		static const int iMaxReactors = 64;
+		static const size_t iQueueSize = 1024;
+
+		struct Config
+		{
+			Config(int threads = 1) : iThreads(threads), eMode(ACCEPT_REUSEPORT),
+				eBackend(ux_selector::BACKEND_EPOLL), iPollTimeout(1), iMaxMsgSize(ReactorMsg::iMaxMsg),
+				iHeaderSize(0), SkipNL(false), iBufferSize(4096), pFactory(NULL),
+				Output(ux_selector::POLICY_DROP_OLDEST) {}
+			int iThreads;
+			AcceptMode eMode;
+			ux_selector::Backend eBackend;
+			int iPollTimeout;           //ms, bounds the delay of Send. 0 busy polls
+			int iMaxMsgSize;            //upto ReactorMsg::iMaxMsg
+			int iHeaderSize;
+			bool SkipNL;
+			int iBufferSize;            //streamer buffer when there is no factory
+			StreamerFactory * pFactory; //NULL makes delimited SocketStreamerBase streamers
+			ux_selector::Backpressure Output;   //a slow client must not hold up its reactor
+			std::vector<int> Cpus;      //reactor i is pinned to Cpus[i % size], empty for unpinned
+			std::string name;           //thread name prefix, reactors are named name-i
+		};
+
+		explicit ReactorGroup(const Config & config);
+		~ReactorGroup();
+
+		//Ports to listen on, before Start
+		void Listen(int iPort) { Ports.push_back(iPort); }
+		//Starts the reactors once all of them are listening. Returns SUCCESS or the
+		//AddServer error of the first reactor that failed (the group is stopped then)
+		int Start();
+		void Stop();
+
+		int size() const { return (int) Reactors.size(); }
+
+		//Application side, one thread. Poll fills upto iMax events, visiting the reactors
+		//round robin. Send returns ux_selector::WOULD_BLOCK when the reactor queue is full.
+		//A send still queued when its session closes is dropped rather than written to a
+		//later session in the same slot, so pass the iGeneration of the session's events.
+		int Poll(ReactorMsg * Msgs, int iMax);
+		int Send(int iReactor, int iClientID, unsigned iGeneration, const char * Msg, int MsgLen);
+
+		//0 when the affinity and name of the reactor thread were applied, otherwise the errno
+		int status(int iReactor) const { return Reactors[iReactor]->iStatus; }
+		void getStats(int iReactor, ReactorStats & Snapshot) const;
+		void getStats(int iReactor, SelectorStats & Snapshot) const;
+
+	private:
+		ReactorGroup& operator=(const ReactorGroup &);     //assigment op
+		ReactorGroup(const ReactorGroup &);                //copy constructor
+
+		struct Reactor
+		{
+			int iIndex;
+			ux_selector * pSelector;
+			std::thread Thread;
+			SPSCRing<ReactorMsg, iQueueSize> ToApp;
+			SPSCRing<ReactorMsg, iQueueSize> FromApp;
+			SPSCRing<int, 256> Handoff;         //sockets from reactor 0
+			std::deque<ReactorMsg> Pending;     //session events the application queue had no room for
+			ReactorStats Stats;
+			SelectorStats Loop;                 //selector stats published each pass, outlive the selector
+			std::atomic<int> iReady;            //0 starting, 1 listening, < 0 failed
+			int iStatus;
+
+			//the rings are cache line aligned, plain new only promises 16 bytes before C++17
+			static void * operator new(size_t iSize)
+			{
+				void * p;
+				if (posix_memalign(&p, CACHE_LINE_SIZE, iSize) != 0) throw std::bad_alloc();
+				return p;
+			}
+			static void operator delete(void * p) { free(p); }
+		};
+
+		void Run(Reactor * pReactor);
+		void PublishStats(Reactor * pReactor);
+		void AcceptAll(Reactor * pReactor);
+		void AddSession(Reactor * pReactor, int iSocket);
+		void Notify(Reactor * pReactor, int iClientID, int iEvent);
+		void ReadAll(Reactor * pReactor);
+		void SendAll(Reactor * pReactor);
+		int Configure(Reactor * pReactor);
+
+		Config Settings;
+		std::vector<int> Ports;
+		std::vector<Reactor *> Reactors;
+		std::atomic<bool> bRunning;
+		int iNextReactor;       //round robin of ACCEPT_HANDOFF, reactor 0 only
+		int iNextPoll;          //round robin of Poll, application thread only
+};
+
+#endif
@@ -11,6 +11,180 @@
 #include "Logger.hpp"
 #include <algorithm>
 
+bool decodeMulticastMsg(MulticastMessage & msg)
+{
+    if ((uint8_t) msg.raw[0] == RMC_V2_MAGIC)
+        return msg.genmsg.length() >= sizeof(MulticastGenMsg) && msg.genmsg.length() <= sizeof(MulticastFullMsg);
+
+    //v1: copy the text fields out before the header is overwritten
+    MulticastGenMsgV1 v1;
+    char text[sizeof(v1.MsgSequence) + 1];
+    memcpy(&v1, msg.raw, sizeof(v1));
+    memcpy(text, v1.MsgLength, sizeof(v1.MsgLength));
+    text[sizeof(v1.MsgLength) - 1] = 0;
+    int len = atoi(text) - (int) sizeof(v1);
+    if (len < 0 || len > RMC_MAX_PAYLOAD) return false;
+    memcpy(text, v1.MsgSequence, sizeof(v1.MsgSequence));
+    text[sizeof(v1.MsgSequence)] = 0;
+
+    memmove(msg.fullmsg.buffer, msg.raw + sizeof(v1), len);
+    msg.genmsg.init(v1.MsgStream, v1.MsgType, strtoull(text, NULL, 10));
+    msg.genmsg.MsgCount = v1.MsgCount;
+    msg.genmsg.setLength(sizeof(MulticastGenMsg) + len);
+    return true;
+}
+
+int encodeMulticastV1(const MulticastMessage & msg, char * out)
+{
+    MulticastGenMsgV1 * v1 = (MulticastGenMsgV1 *) out;
+    int len = msg.genmsg.length() - (int) sizeof(MulticastGenMsg);
+    memset(v1, 0, sizeof(*v1));
+    sprintf(v1->MsgLength, "%d", (int) sizeof(*v1) + len);
+    sprintf(v1->MsgSequence, "%llu", (unsigned long long) msg.genmsg.sequence());
+    v1->MsgType   = msg.genmsg.MsgType;
+    v1->MsgStream = msg.genmsg.MsgStream;
+    v1->MsgCount  = msg.genmsg.MsgCount;
+    memcpy(out + sizeof(*v1), msg.fullmsg.buffer, len);
+    return (int) sizeof(*v1) + len;
+}
+
+int ReliableMulticastChannel::writeMsg(int32_t clientID, MulticastMessage &msg, int version)
+{
+    if (version >= RMC_VERSION_2)
+        return selector.Write(clientID, (char *)&msg, msg.genmsg.length());
+    MulticastMessage v1msg;
+    int len = encodeMulticastV1(msg, v1msg.raw);
+    return selector.Write(clientID, v1msg.raw, len);
+}
+
+int ReliableMulticastChannel::publish(MulticastMessage &msg)
+{
+    if (max_version >= RMC_VERSION_2)
+        return selector.Publish(multicast_clientid, (char *)&msg, msg.genmsg.length());
+    MulticastMessage v1msg;
+    int len = encodeMulticastV1(msg, v1msg.raw);
+    return selector.Publish(multicast_clientid, v1msg.raw, len);
+}
+
+//VERSION requests come from recovery clients (gapfiller side) and are always answered in v1.
+//The answer on a recovery session (subscriber side) switches the session to the agreed version.
+void ReliableMulticastChannel::processVersion(MulticastMessage &msg, int32_t clientID)
+{
+    int peer = std::max((int) msg.genmsg.MsgCount, RMC_VERSION_1);
+    for (auto &data : data_streams)
+    {
+        if (data.second.recoveryClientID != clientID) continue;
+        data.second.recovery_version = std::min(peer, max_version);
+        LOG_DEBUG << "Recovery session of stream " << (int) data.first << " at version "
+                  << data.second.recovery_version << LOG_END;
+        return;
+    }
+
+    int agreed = std::min(peer, max_version);
+    peer_versions[clientID] = agreed;
+    MulticastMessage reply;
+    reply.genmsg.init(msg.genmsg.MsgStream, VERSION);
+    reply.genmsg.MsgCount = (char) agreed;
+    writeMsg(clientID, reply, RMC_VERSION_1);
+}
+
+void ReliableMulticastChannel::setBudgets(int publish, int recovery)
+{
+    publish_budget  = std::max(publish, 1);
+    recovery_budget = std::max(recovery, 1);
+    burst.reserve(publish_budget);
+    burst_sequence.reserve(publish_budget);
+    burst_scratch.resize(publish_budget);
+}
+
+void ReliableMulticastChannel::setPacking(int datagram)
+{
+    max_datagram = std::min(std::max(datagram, 0), (int) sizeof(MulticastFullMsg));
+}
+
+//Sends the next msgs of the publish stream, upto the budget, as one batch. Consecutive msgs
+//share a PACKED datagram while they fit. Returns the number of datagrams sent.
+int ReliableMulticastChannel::publishBurst(struct StreamData & data)
+{
+    bool packing = max_version >= RMC_VERSION_2 && max_datagram > 0;
+    int scratch = 0, open = -1;     //open is the datagram still taking msgs
+    burst.clear();
+    burst_sequence.clear();
+    uint64_t seq = data.local_read_index;
+    for (int count = 0; count < publish_budget && seq <= data.max_nogap_sequence; count++, seq++)
+    {
+        MulticastMessage * msgptr = data.buffer->get(seq);
+        size_t len = msgptr->genmsg.length();
+        MulticastMessage * pack = (open >= 0)? (MulticastMessage *) burst[open].iov_base: nullptr;
+        //a single msg still gets the PACKED header in front once a second one joins it
+        size_t header = (pack != nullptr && pack->genmsg.MsgType != PACKED)? sizeof(MulticastGenMsg): 0;
+        if (pack != nullptr && header + burst[open].iov_len + len <= (size_t) max_datagram)
+        {
+            if (pack->genmsg.MsgType != PACKED)
+            {
+                //second msg of the datagram, move the first into a PACKED one
+                MulticastMessage & packed = burst_scratch[scratch++];
+                packed.genmsg.init(data.streamid, PACKED, burst_sequence[open]);
+                packed.genmsg.MsgCount = 1;
+                memcpy(packed.fullmsg.buffer, pack, burst[open].iov_len);
+                packed.genmsg.setLength(sizeof(MulticastGenMsg) + burst[open].iov_len);
+                pack = &packed;
+                burst[open].iov_base = pack;
+            }
+            memcpy((char *) pack + pack->genmsg.length(), msgptr, len);
+            pack->genmsg.setLength(pack->genmsg.length() + len);
+            burst[open].iov_len = pack->genmsg.length();
+            if (++pack->genmsg.MsgCount >= RMC_MAX_PACKED)
+                open = -1;
+            continue;
+        }
+
+        struct iovec datagram;
+        if (max_version < RMC_VERSION_2)
+        {
+            datagram.iov_base = burst_scratch[scratch].raw;
+            datagram.iov_len  = encodeMulticastV1(*msgptr, burst_scratch[scratch++].raw);
+        }
+        else
+        {
+            datagram.iov_base = msgptr;
+            datagram.iov_len  = len;
+        }
+        burst.push_back(datagram);
+        burst_sequence.push_back(seq);
+        //only a datagram with room for a packed header and another msg stays open
+        open = (packing && len + 2 * sizeof(MulticastGenMsg) <= (size_t) max_datagram)? (int) burst.size() - 1: -1;
+    }
+    if (burst.empty()) return 0;
+
+    int sent = selector.PublishBatch(multicast_clientid, burst.data(), (int) burst.size());
+    //resume from the first datagram that did not go out
+    data.local_read_index = (sent >= 0 && sent < (int) burst.size())? burst_sequence[sent]:
+                            (sent < 0)? burst_sequence[0]: seq;
+    return sent;
+}
+
+//Splits a PACKED datagram into its msgs
+void ReliableMulticastChannel::processPacked(MulticastMessage &msg, struct StreamData & data, Timestamp &now)
+{
+    MulticastMessage inner;
+    size_t pos = 0, end = msg.genmsg.length() - sizeof(MulticastGenMsg);
+    for (int ii = 0; ii < (uint8_t) msg.genmsg.MsgCount; ii++)
+    {
+        if (pos + sizeof(MulticastGenMsg) > end) break;
+        memcpy(&inner.genmsg, msg.fullmsg.buffer + pos, sizeof(MulticastGenMsg));
+        size_t len = inner.genmsg.length();
+        if (inner.genmsg.MsgMagic != RMC_V2_MAGIC || len < sizeof(MulticastGenMsg) || pos + len > end)
+        {
+            LOG_ERROR << "Malformed packed msg at seq " << msg.genmsg.sequence() << LOG_END;
+            return;
+        }
+        memcpy(inner.fullmsg.buffer, msg.fullmsg.buffer + pos + sizeof(MulticastGenMsg), len - sizeof(MulticastGenMsg));
+        processStreamEvent(inner, data, now);
+        pos += len;
+    }
+}
+
 void ReliableMulticastChannel::SetupGapFill(int32_t gapfillacceptport_)
 {
     gapfillacceptport = gapfillacceptport_;
@@ -54,7 +228,8 @@ void ReliableMulticastChannel::SetupMulticast(string local_addr, string mcast_ad
         data.local_read_index                   = 0;
         data.buffer                             = new MsgBuffer<MulticastMessage>();
         data.recoveryClientID                   = -1;
-        data.buffer->setCapacity(100);
+        data.recovery_version                   = RMC_VERSION_1;
+        data.buffer->setCapacity(buffer_capacity);
         data_streams[data.streamid]             = data;
     }
     else
@@ -98,8 +273,71 @@ void ReliableMulticastChannel::AddRecoveryToStream(char stream, std::string reco
     data.buffer                             = new MsgBuffer<MulticastMessage>();
     RMCSocketStreamer * streamer            = new RMCSocketStreamer(iClientFD, 2048);
     data.recoveryClientID                   = selector.AddClient(streamer, sizeof(MulticastMessage), 6, false);
-    data.buffer->setCapacity(100);
+    data.recovery_version                   = RMC_VERSION_1;
+    data.buffer->setCapacity(buffer_capacity);
     data_streams[data.streamid]             = data;
+
+    //ask for the newest version both sides know, until answered the session stays in v1
+    if (max_version > RMC_VERSION_1)
+    {
+        MulticastMessage msg;
+        msg.genmsg.init(stream, VERSION);
+        msg.genmsg.MsgCount = (char) max_version;
+        writeMsg(data.recoveryClientID, msg, RMC_VERSION_1);
+    }
+}
+
+//One msg from the multicast channel, a recovery client or the recovery session
+void ReliableMulticastChannel::processMsg(MulticastMessage &msg, int32_t iClientID, Timestamp &now)
+{
+    if (!decodeMulticastMsg(msg))
+    {
+        LOG_ERROR << "Malformed msg from client " << iClientID << LOG_END;
+        return;
+    }
+    if (msg.genmsg.MsgType == VERSION)
+    {
+        processVersion(msg, iClientID);
+        return;
+    }
+
+    //Simply ignore for streams not handled
+    auto streamItr = data_streams.find(msg.genmsg.MsgStream);
+    if (streamItr == data_streams.end())
+    {
+        if (iClientID == multicast_clientid) return;
+        struct StreamData data;
+        data.last_event_time.set();
+        data.last_gapfill_time.set();
+        data.streamid                           = publish_stream_id;
+        data.recoveryhost                       = "";
+        data.recoveryport                       = 0;
+        data.last_gapfill_sequence              = 0;
+        data.max_nogap_sequence                 = 0;
+        data.local_read_index                   = 0;
+        data.buffer                             = new MsgBuffer<MulticastMessage>();
+        data.recoveryClientID                   = -1;
+        data.recovery_version                   = RMC_VERSION_1;
+        data.buffer->setCapacity(buffer_capacity);
+        data_streams[data.streamid]             = data;
+    }
+    
+    //gapfill requests for downstream.
+    if ( msg.genmsg.MsgType == GAPFILL || msg.genmsg.MsgType == TRANSMITOK)
+    {
+        processClientEvent(msg,streamItr->second,iClientID);
+    }
+    else //either multicast (iClientID == multicast_clientid) or recovery data from upstream
+    {
+        if (iClientID == multicast_clientid)
+            streamItr->second.last_event_time.set();
+        else
+            LOG_DEBUG << "got gap fill response for seq " << msg.genmsg.sequence() << LOG_END;
+        if (msg.genmsg.MsgType == PACKED)
+            processPacked(msg,streamItr->second, now);
+        else
+            processStreamEvent(msg,streamItr->second, now);
+    }
 }
 
 void ReliableMulticastChannel::process()
@@ -117,73 +355,57 @@ void ReliableMulticastChannel::process()
         if ( iRC == ux_selector::END_OF_SOCK_LIST) break;
         if ( iRC == ux_selector::WOULD_BLOCK) continue;
         RMCSocketStreamer * streamer = new RMCSocketStreamer(iClientFD, 4096);
-        selector.AddClient(streamer, sizeof(MulticastMessage), 6, false);
+        iClientID = selector.AddClient(streamer, sizeof(MulticastMessage), 6, false);
+        peer_versions.erase(iClientID);     //v1 until the client asks for more
     }
     
-    while ((iRC = selector.Read(iClientID, (char *)&msg)) != ux_selector::END_OF_SOCK_LIST)
+    //each poll yields one datagram per socket, poll again while msgs keep coming so a
+    //publish burst is taken in one pass
+    for (int round = 0; round < publish_budget; round++)
     {
-        if ( iRC == ux_selector::SUCCESS )
+        if (round > 0)
+            selector.PollForSocketEvent();
+        int count = 0;
+        while ((iRC = selector.Read(iClientID, (char *)&msg)) != ux_selector::END_OF_SOCK_LIST)
         {
-            //Simply ignore for streams not handled
-            auto streamItr = data_streams.find(msg.genmsg.MsgStream);
-            if (streamItr == data_streams.end())
-            {
-                if (iClientID == multicast_clientid) continue;
-                struct StreamData data;
-                data.last_event_time.set();
-                data.last_gapfill_time.set();
-                data.streamid                           = publish_stream_id;
-                data.recoveryhost                       = "";
-                data.recoveryport                       = 0;
-                data.last_gapfill_sequence              = 0;
-                data.max_nogap_sequence                 = 0;
-                data.local_read_index                   = 0;
-                data.buffer                             = new MsgBuffer<MulticastMessage>();
-                data.recoveryClientID                   = -1;
-                data.buffer->setCapacity(100);
-                data_streams[data.streamid]             = data;
-            }
-            
-            //gapfill requests for downstream.
-            if ( msg.genmsg.MsgType == GAPFILL || msg.genmsg.MsgType == TRANSMITOK)
-            {
-                processClientEvent(msg,streamItr->second,iClientID);
-            }
-            else //either multicast (iClientID == multicast_clientid) or recovery data from upstream
-            {
-                if (iClientID == multicast_clientid)
-                    streamItr->second.last_event_time.set();
-                else
-                    LOG_DEBUG << "got gap fill response for seq " << msg.genmsg.MsgSequence << LOG_END;
-                processStreamEvent(msg,streamItr->second, now);
-            }
+            if ( iRC != ux_selector::SUCCESS ) continue;
+            processMsg(msg, iClientID, now);
+            count++;
         }
+        if (count == 0) break;
     }
     
-    //write at most one recovery response per client/stream during each pass
+    //write upto the recovery budget per client/stream during each pass
     for (auto &data : data_streams )
     {
         for (auto &client : data.second.clients)
         {
-            //Recovery complete. Skip for this client/stream
-            if (client.second.gap_fill_count <= 0) continue;
-            
-            //Recovery stalled due to gaps in the stream buffer. Wait for buffer to finish the gapfills
-            if ( client.second.gap_fill_index > data.second.max_nogap_sequence ) continue;
-            
-            //Data requested outside the buffer range. At least recover msgs not lost yet
-            if ( client.second.gap_fill_index < data.second.buffer->firstSequence() )
+            auto peer = peer_versions.find(client.second.clientID);
+            int version = (peer == peer_versions.end())? RMC_VERSION_1: peer->second;
+            for (int sent = 0; sent < recovery_budget; sent++)
             {
-                uint64_t lastmsg = client.second.gap_fill_index + client.second.gap_fill_count;
-                client.second.gap_fill_index = data.second.buffer->firstSequence();
-                client.second.gap_fill_count = lastmsg - client.second.gap_fill_index;
+                //Recovery complete. Skip for this client/stream
+                if (client.second.gap_fill_count <= 0) break;
+
+                //Recovery stalled due to gaps in the stream buffer. Wait for buffer to finish the gapfills
+                if ( client.second.gap_fill_index > data.second.max_nogap_sequence ) break;
+
+                //Data requested outside the buffer range. At least recover msgs not lost yet
+                if ( client.second.gap_fill_index < data.second.buffer->firstSequence() )
+                {
+                    uint64_t lastmsg = client.second.gap_fill_index + client.second.gap_fill_count;
+                    client.second.gap_fill_index = data.second.buffer->firstSequence();
+                    client.second.gap_fill_count = (lastmsg > client.second.gap_fill_index)?
+                                                    lastmsg - client.second.gap_fill_index: 0;
+                    if (client.second.gap_fill_count == 0) break;
+                }
+                msgptr = data.second.buffer->get(client.second.gap_fill_index);
+                if (msgptr == nullptr) break;
+                LOG_DEBUG << "sent gapfill response for seq " << msgptr->genmsg.sequence() << LOG_END;
+                writeMsg(client.second.clientID, *msgptr, version);
+                client.second.gap_fill_index++;
+                client.second.gap_fill_count--;
             }
-            msgptr = data.second.buffer->get(client.second.gap_fill_index);
-            msgptr->genmsg.MsgLength[5] = 0;
-            LOG_DEBUG << "sent gapfill response for seq " << msgptr->genmsg.MsgSequence << LOG_END;
-            selector.Write(client.second.clientID, (char *)msgptr, atoi(msgptr->genmsg.MsgLength));
-            client.second.gap_fill_index++;
-            client.second.gap_fill_count--;
         }
     }
     
@@ -193,22 +415,16 @@ void ReliableMulticastChannel::process()
         struct StreamData& publish_stream = data_streams.begin()->second;
         if ( publish_stream.buffer->size() > 0 && publish_stream.local_read_index <= publish_stream.max_nogap_sequence )
         {
-            msgptr = publish_stream.buffer->get(publish_stream.local_read_index++);
-            msgptr->genmsg.MsgLength[5] = 0;
-            //std::cout << "Publish msg " << msgptr->genmsg.MsgSequence << std::endl;
-            if ( (selector.Publish(multicast_clientid, (char *)msgptr, atoi(msgptr->genmsg.MsgLength))) < 0)
+            if ( (iRC = publishBurst(publish_stream)) < 0)
                 std::cout << "Publish failed. Status " << iRC << std::endl;
             publish_stream.last_event_time = now;
         }
         else if ( now - publish_stream.last_event_time > 5000000 ) //5 sec
         {
-            msg.genmsg.MsgType = HEARTBEAT;
-            msg.genmsg.MsgStream = publish_stream_id;
-            sprintf(msg.genmsg.MsgLength,"%lu",sizeof(msg.genmsg));
             uint64_t seq = (publish_stream.buffer->nextAvailableSequence()==0)? 0:
                             publish_stream.buffer->nextAvailableSequence()-1;
-            sprintf(msg.genmsg.MsgSequence,"%llu",seq);
-            if ( (selector.Publish(multicast_clientid, (char *)&msg, atoi(msg.genmsg.MsgLength))) < 0)
+            msg.genmsg.init(publish_stream_id, HEARTBEAT, seq);
+            if ( (iRC = publish(msg)) < 0)
                 LOG_ERROR << "Publish failed. Status " << iRC << LOG_END;
             publish_stream.last_event_time = now;
         }
@@ -220,14 +436,17 @@ bool ReliableMulticastChannel::publishMsg(const char * sMsg, int32_t len)
     if ( publish_stream_id <= 0 ) return false;
     
     struct StreamData& publish_stream   = data_streams.begin()->second;
-    publish_stream.max_nogap_sequence   = publish_stream.buffer->nextAvailableSequence();
     
-    MulticastMessage msg, *msgptr;
-    msg.genmsg.init(publish_stream_id, APPLICATION, publish_stream.max_nogap_sequence);
-    publish_stream.buffer->insert(msg);
-    msgptr = publish_stream.buffer->get(publish_stream.max_nogap_sequence);
-    sprintf(msgptr->genmsg.MsgLength,"%lu",len+sizeof(msg.genmsg));
+    //build the message in place
+    MulticastMessage *msgptr = publish_stream.buffer->reserve();
+    if ( msgptr == nullptr ) return false;
+    uint64_t seq = publish_stream.buffer->nextAvailableSequence();
+    if ( len < 0 || len > RMC_MAX_PAYLOAD ) return false;
+    msgptr->genmsg.init(publish_stream_id, APPLICATION, seq);
+    msgptr->genmsg.setLength(len+sizeof(msgptr->genmsg));
     memcpy(msgptr->fullmsg.buffer,sMsg,len);
+    publish_stream.buffer->commit();
+    publish_stream.max_nogap_sequence   = seq;
     //LOG_DEBUG << "Publish msg request " << msg.genmsg.MsgSequence << LOG_END;
     return true;
 }
@@ -260,8 +479,13 @@ MulticastMessage * ReliableMulticastChannel::getNextMsgByIndex(char stream)
     //no consumption beyond the point where stream has gaps
     if ( streamItr->second.buffer->size() == 0 || streamItr->second.local_read_index > streamItr->second.max_nogap_sequence)
         return nullptr;
-    
-    return streamItr->second.buffer->get(streamItr->second.local_read_index++);
+
+    //max_nogap_sequence stops on the first filler, it is consumed once the gapfill arrives
+    MulticastMessage * msgptr = streamItr->second.buffer->get(streamItr->second.local_read_index);
+    if ( msgptr == nullptr || msgptr->genmsg.MsgType == FILLER )
+        return nullptr;
+    streamItr->second.local_read_index++;
+    return msgptr;
 }
 
 MulticastMessage * ReliableMulticastChannel::getNextMsgAsap(char stream)
@@ -291,21 +515,20 @@ bool ReliableMulticastChannel::processStreamEvent(MulticastMessage &msg, struct
 {
     if (publish_stream_id == data.streamid) return false;
     
-    uint64_t msgseq = atol(msg.genmsg.MsgSequence);
+    uint64_t msgseq = msg.genmsg.sequence();
     
     //discard old message
     if (msgseq < data.buffer->firstSequence())
         return false;
 
     MulticastMessage fillermsg, * bufmsg;
-    fillermsg.genmsg.MsgType = FILLER;
-    fillermsg.genmsg.MsgStream = data.streamid;
+    fillermsg.genmsg.init(data.streamid, FILLER);
     if (msgseq >= data.buffer->nextAvailableSequence())
     {
         //put fillers for any gaps and then insert the actual msg at the right place
         for (uint64_t seq = data.buffer->nextAvailableSequence(); seq < msgseq; seq++)
         {
-            sprintf(fillermsg.genmsg.MsgSequence, "%llu", seq);
+            fillermsg.genmsg.setSequence(seq);
             //std::cout << "filler inserted " << data.buffer->nextAvailableSequence() << std::endl;
             data.buffer->insert(fillermsg);
         }
@@ -313,7 +536,6 @@ bool ReliableMulticastChannel::processStreamEvent(MulticastMessage &msg, struct
         if (msg.genmsg.MsgType == HEARTBEAT)
             msg.genmsg.MsgType = FILLER;
         
-        sprintf(msg.genmsg.MsgSequence, "%llu", msgseq);
         //std::cout << "msg inserted " << data.buffer->nextAvailableSequence() << std::endl;
         data.buffer->insert(msg);
         
@@ -345,20 +567,26 @@ bool ReliableMulticastChannel::processStreamEvent(MulticastMessage &msg, struct
             
             data.last_gapfill_time      = now;
             data.last_gapfill_sequence  = data.max_nogap_sequence;
+            //the whole gap in one request, responses for msgs already here are ignored
+            uint64_t gap = data.buffer->nextAvailableSequence() - 1 - data.max_nogap_sequence;
             fillermsg.genmsg.init(data.streamid, GAPFILL,data.max_nogap_sequence);
-            fillermsg.genmsg.MsgCount   = 1;
-            selector.Write(data.recoveryClientID, (char * )&fillermsg, sizeof(fillermsg.genmsg));
-            LOG_DEBUG << "generated gapfill request for seq " << fillermsg.genmsg.MsgSequence << LOG_END;
+            fillermsg.genmsg.MsgCount   = (char) std::min(gap, (uint64_t) RMC_MAX_GAPFILL);
+            writeMsg(data.recoveryClientID, fillermsg, data.recovery_version);
+            LOG_DEBUG << "generated gapfill request for seq " << fillermsg.genmsg.sequence() << LOG_END;
         }
     }
 
-    //publish transmitok to notify upstream node every 10 msgs
-    if (data.max_nogap_sequence % 10 == 0 ||
-        (data.max_nogap_sequence - orig_max_nogap_sequence) > 10)
+    //publish transmitok to notify upstream node every 10 msgs. Upstream flushes upto and
+    //including the sequence, so a filler at max_nogap_sequence is not acknowledged
+    bufmsg = data.buffer->get(data.max_nogap_sequence);
+    bool missing = (bufmsg != nullptr && bufmsg->genmsg.MsgType == FILLER);
+    if ((data.max_nogap_sequence % 10 == 0 ||
+        (data.max_nogap_sequence - orig_max_nogap_sequence) > 10) &&
+        !(missing && data.max_nogap_sequence == 0))
     {
-        fillermsg.genmsg.init(data.streamid, TRANSMITOK, data.max_nogap_sequence);
+        fillermsg.genmsg.init(data.streamid, TRANSMITOK, data.max_nogap_sequence - (missing? 1: 0));
         //std::cout << "generated transmitok request " << std::endl;
-        selector.Write(data.recoveryClientID, (char * )&fillermsg, atoi(fillermsg.genmsg.MsgLength));
+        writeMsg(data.recoveryClientID, fillermsg, data.recovery_version);
     }
 
     return true;
@@ -385,12 +613,12 @@ bool ReliableMulticastChannel::processClientEvent(MulticastMessage &msg, struct
     {
         //donot process if another recovery is in progress
         if (clientItr->second.gap_fill_count > 0 ) return false;
-        clientItr->second.gap_fill_index = atol(msg.genmsg.MsgSequence);
+        clientItr->second.gap_fill_index = msg.genmsg.sequence();
         clientItr->second.gap_fill_count = msg.genmsg.MsgCount;
     }
     else if (msg.genmsg.MsgType == TRANSMITOK )
     {
-        clientItr->second.archive_ok_index  = max(clientItr->second.archive_ok_index, (uint64_t)atol(msg.genmsg.MsgSequence));
+        clientItr->second.archive_ok_index  = max(clientItr->second.archive_ok_index, msg.genmsg.sequence());
         uint64_t min_archive_ok_index       = data.buffer->nextAvailableSequence();
         min_archive_ok_index                = min(min_archive_ok_index,data.local_read_index);
         for (auto & tempItr : data.clients)
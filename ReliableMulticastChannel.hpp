@@ -2,6 +2,7 @@
 #define _RELIABLE_MULTICAST_CHANNEL_HPP_
 
 #include <cstdint>
+#include <cstddef>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -12,6 +13,9 @@
 #include "TcpUtils.hpp"
 #include "Logger.hpp"
 #include <algorithm>
+#include <endian.h>
+#include <vector>
+#include <sys/uio.h>
 
 //genmsg msg types
 const char HEARTBEAT    = 1;
@@ -19,8 +23,21 @@ const char GAPFILL      = 2;
 const char TRANSMITOK   = 3;
 const char FILLER       = 4;
 const char APPLICATION  = 5;
+const char VERSION      = 6;    //recovery session handshake, MsgCount is the version
+const char PACKED       = 7;    //v2 only, MsgCount v2 msgs back to back in the payload
 
-struct MulticastGenMsg
+//Wire formats. v1 is ASCII (length and sequence as text), v2 is a binary little endian
+//header that is also the in memory format. v1 peers are converted at the edges.
+//A v2 msg starts with RMC_V2_MAGIC where a v1 msg starts with a digit of its length.
+const int RMC_VERSION_1      = 1;
+const int RMC_VERSION_2      = 2;
+const int RMC_VERSION_MAX    = RMC_VERSION_2;
+const uint8_t RMC_V2_MAGIC   = 0xB2;
+const int RMC_MAX_PAYLOAD    = 1450;
+const int RMC_MAX_PACKED     = 127;     //msgs per PACKED datagram, MsgCount is a char
+const int RMC_MAX_GAPFILL    = 127;     //msgs per GAPFILL request, MsgCount is a char
+
+struct MulticastGenMsgV1
 {
     char    MsgLength[6];
     char    MsgType;
@@ -28,37 +45,65 @@ struct MulticastGenMsg
     char    MsgCount;
     char    MsgSequence[20];
     char    MsgSender[10];
-    
+};
+
+struct MulticastGenMsg
+{
+    uint8_t  MsgMagic;
+    char     MsgType;
+    char     MsgStream;
+    char     MsgCount;
+    uint16_t MsgLength;     //header + payload, little endian
+    uint16_t MsgReserved;
+    uint64_t MsgSequence;   //little endian
+
     void init(char stream, char type, uint64_t seq = 0)
     {
         memset(this,0,sizeof(*this));
-        sprintf(MsgLength,"%d",(int)sizeof(*this));
-        sprintf(MsgSequence,"%llu",seq);
+        MsgMagic = RMC_V2_MAGIC;
         MsgStream = stream;
         MsgType = type;
+        setLength(sizeof(*this));
+        setSequence(seq);
     }
+    uint16_t length() const         { return le16toh(MsgLength); }
+    uint64_t sequence() const       { return le64toh(MsgSequence); }
+    void setLength(uint16_t len)    { MsgLength = htole16(len); }
+    void setSequence(uint64_t seq)  { MsgSequence = htole64(seq); }
 };
 
 struct MulticastFullMsg
 {
     struct MulticastGenMsg  genmsg;
-    char    buffer[1450];
+    char    buffer[RMC_MAX_PAYLOAD];
 };
 
 union MulticastMessage
 {
     struct MulticastFullMsg fullmsg;
     struct MulticastGenMsg  genmsg;
+    char    raw[sizeof(MulticastGenMsgV1) + RMC_MAX_PAYLOAD];   //room for a v1 msg before decoding
 };
 
+//Converts a v1 msg to v2 in place, v2 msgs are left alone. False when the msg is malformed
+bool decodeMulticastMsg(MulticastMessage & msg);
+//Writes msg in v1 format to out (sizeof(MulticastMessage) bytes), returns the length
+int encodeMulticastV1(const MulticastMessage & msg, char * out);
+
 class RMCSocketStreamer : public SocketStreamerBase
 {
     public:
         RMCSocketStreamer(int iSocket, int iBufferSize): SocketStreamerBase(iSocket, iBufferSize) { }
         int iCalculateMsgSize()
         {
+            if ((uint8_t) sMsgBuffer[iPos] == RMC_V2_MAGIC)
+            {
+                uint16_t len;
+                memcpy(&len, &sMsgBuffer[iPos + offsetof(MulticastGenMsg, MsgLength)], sizeof(len));
+                return le16toh(len);
+            }
             sMsgBuffer[iPos+5] = 0; //make sure last char is a null terminator
-            return atoi(sMsgBuffer);
+            return atoi(&sMsgBuffer[iPos]);
         }
 };
 
@@ -86,6 +131,8 @@ struct StreamData
     //used for making gap fill requests
     Timestamp   last_gapfill_time;
     uint64_t    last_gapfill_sequence;
+    //format written to the recovery session, v2 once the gapfiller agreed
+    int         recovery_version;
 };
 
 //Class for reliable multicasting. Can be used to setup as publish node or subscriber node
@@ -97,13 +144,34 @@ struct StreamData
 //  Subscriber nodes can provide msgs to local consumers on arrival (unreliable) or after resequencing (reliable)
 //  Subscriber nodes set with gapfill can act as relay to provide recovery to other peer subscribers
 //  Data outside the buffered range is non-recoverable from this framework (not guaranteed).
+//  version is what a publisher sends on multicast and the highest version a recovery session
+//  agrees to. Subscribers read both formats, recovery sessions start in v1 and switch once
+//  the VERSION handshake is answered (v1 gapfillers never answer). Multicast is not negotiated
+//  and v1 subscribers cannot read v2 datagrams, so v2 is opt in (RMC_VERSION_2) once every
+//  subscriber of the channel is upgraded.
+//  Each process() pass publishes upto the publish budget with one sendmmsg and writes upto
+//  the recovery budget per recovery client. A v2 publisher packs consecutive msgs into
+//  PACKED datagrams of upto max_datagram bytes.
 class ReliableMulticastChannel
 {
     public:
         //Provide streamid for publisher nodes
-        ReliableMulticastChannel(char stream = 0) : selector(0), publish_stream_id(stream), gapfillacceptport(0)  {}
+        ReliableMulticastChannel(char stream = 0, int version = RMC_VERSION_1) : selector(0),
+            publish_stream_id(stream), gapfillacceptport(0), max_version(version),
+            publish_budget(0), recovery_budget(0), max_datagram(0), buffer_capacity(100)
+        {
+            setBudgets(64, 16);
+            setPacking(sizeof(MulticastFullMsg));
+        }
         ~ReliableMulticastChannel() { }
 
+        //msgs per process() pass, at least 1 each
+        void setBudgets(int publish, int recovery);
+        //largest PACKED datagram, upto sizeof(MulticastFullMsg). 0 publishes one msg per datagram
+        void setPacking(int datagram);
+        //msgs kept per stream for resequencing and recovery, call before the Setup/AddRecovery calls
+        void setBufferCapacity(int capacity) { buffer_capacity = capacity; }
+
         void SetupGapFill(int32_t gapfillacceptport_);
         void SetupMulticast(string local_addr, string mcast_addr, int mcastport );
         void AddRecoveryToStream(char stream, std::string recovery_host, int32_t recovery_port);
@@ -117,6 +185,12 @@ class ReliableMulticastChannel
     
         bool processStreamEvent(MulticastMessage &msg, struct StreamData & data, Timestamp &now);
         bool processClientEvent(MulticastMessage &msg, struct StreamData & data, int32_t clientID);
+        void processVersion(MulticastMessage &msg, int32_t clientID);
+        int writeMsg(int32_t clientID, MulticastMessage &msg, int version);
+        int publish(MulticastMessage &msg);
+        int publishBurst(struct StreamData & data);
+        void processMsg(MulticastMessage &msg, int32_t iClientID, Timestamp &now);
+        void processPacked(MulticastMessage &msg, struct StreamData & data, Timestamp &now);
     
         ux_selector selector;
         std::string mcast_address;
@@ -127,6 +201,17 @@ class ReliableMulticastChannel
         std::map<char,struct StreamData> data_streams;
         const char publish_stream_id;
         int32_t     gapfillacceptport; //used by gapfiller only
+        const int   max_version;
+        std::map<int32_t,int> peer_versions; //agreed version of recovery clients (gapfiller)
+        int         publish_budget;
+        int         recovery_budget;
+        int         max_datagram;
+        int         buffer_capacity;
+        //datagrams of the current publish burst, the first sequence of each and the
+        //scratch space of the PACKED (or v1 encoded) ones
+        std::vector<struct iovec>       burst;
+        std::vector<uint64_t>           burst_sequence;
+        std::vector<MulticastMessage>   burst_scratch;
 };
 
 #endif
@@ -18,23 +18,24 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <iostream>
 
 SocketStreamerBase::SocketStreamerBase(int iSocket, int iBufferSize, char cDel):
-                    iBufferSize(iBufferSize), cDelimiter(cDel), iSockFD(iSocket)
+                    iBufferSize(iBufferSize), cDelimiter(cDel), iSockFD(iSocket), pSource(NULL), pCounters(&Counters)
 {
+	memset(&Counters, 0, sizeof(Counters));
 	sMsgBuffer = NULL;
+	bMirrored = false;
+	iHeld = 0;
 	//sWriteBuffer = NULL;
 	CreateBuffer();
 }
 
 SocketStreamerBase::~SocketStreamerBase()
 {
-	if ( sMsgBuffer != NULL)
-	{
-		delete [] sMsgBuffer;
-		sMsgBuffer = NULL;
-	}
+	ReleaseBuffer();
 	//if (sWriteBuffer != NULL)
 	//{
 	//	delete [] sWriteBuffer;
@@ -49,14 +50,104 @@ void SocketStreamerBase::CreateBuffer()
 
 	//sWriteBuffer = new char[iBufferSize+1];
 
-	if (sMsgBuffer != NULL)
-		delete [] sMsgBuffer;
+	ReleaseBuffer();
 
-	sMsgBuffer = new char[iBufferSize];
+	//Map the same pages twice back to back, a message that wraps past the end
+	//continues in the mirror and never has to be moved to the front
+	long iPage = sysconf(_SC_PAGESIZE);
+	int iSize = (int) (((iBufferSize + iPage - 1) / iPage) * iPage);
+	int fd = memfd_create("SocketStreamerBase", MFD_CLOEXEC);
+	if (fd >= 0 && ftruncate(fd, iSize) == 0)
+	{
+		void * base = mmap(NULL, 2 * (size_t) iSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base != MAP_FAILED)
+		{
+			char * sBase = (char *) base;
+			if (mmap(sBase, iSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == sBase &&
+				mmap(sBase + iSize, iSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == sBase + iSize)
+			{
+				sMsgBuffer = sBase;
+				iBufferSize = iSize;
+				bMirrored = true;
+			}
+			else
+				munmap(base, 2 * (size_t) iSize);
+		}
+	}
+	if (fd >= 0) close(fd);
+
+	if (sMsgBuffer == NULL)
+		sMsgBuffer = new char[iBufferSize];
 	//touch it to ensure preallocation
 	memset(sMsgBuffer,0,iBufferSize);
 	iPos = 0;
 	iBytes = 0;
+	iHeld = 0;
+}
+
+void SocketStreamerBase::ReleaseBuffer()
+{
+	if (sMsgBuffer == NULL) return;
+	if (bMirrored)
+		munmap(sMsgBuffer, 2 * (size_t) iBufferSize);
+	else
+		delete [] sMsgBuffer;
+	sMsgBuffer = NULL;
+	bMirrored = false;
+}
+
+void SocketStreamerBase::Consume(int iLen)
+{
+	iPos += iLen;
+	iBytes -= iLen;
+	if (iBytes == 0 && iHeld == 0)
+		iPos = 0;
+	else if (bMirrored && iPos >= iBufferSize)
+		iPos -= iBufferSize;
+}
+
+//Bytes behind iPos that views still point to become free space again
+void SocketStreamerBase::ReleaseView()
+{
+	if (iHeld == 0) return;
+	iHeld = 0;
+	if (iBytes == 0)
+		iPos = 0;
+}
+
+//One read into the free space after the unread bytes. With a mirrored buffer the
+//free space is always contiguous, otherwise unread bytes move to the front first
+//(only when no view is held).
+int SocketStreamerBase::iFill()
+{
+	if (!bMirrored && iHeld == 0 && iPos > 0 && iPos + iBytes == iBufferSize)
+	{
+		memmove(sMsgBuffer, &sMsgBuffer[iPos], iBytes);
+		iPos = 0;
+	}
+	int iFree = (bMirrored)? iBufferSize - iBytes - iHeld: iBufferSize - (iPos + iBytes);
+	if (iFree <= 0) return ERROR_BUFFER_FULL;
+
+	int count = iRecv(&sMsgBuffer[iPos + iBytes], iFree);
+	StatAdd(pCounters->iReadCalls);
+	if (count <= 0)
+	{
+		if (count == 0 || errno != EAGAIN)
+		{
+			perror( "SocketStreamerBase::iReadNonBlocking(N)" );
+			return ERROR_SOCKET_READ;
+		}
+		StatAdd(pCounters->iReadEagain);
+		return ERROR_EAGAIN;
+	}
+	StatAdd(pCounters->iBytesIn, count);
+	iBytes += count;
+	return count;
+}
+
+int SocketStreamerBase::iRecv(char * sBuf, int iLen)
+{
+	return (pSource != NULL)? pSource->iRead(sBuf, iLen): read(iSockFD, sBuf, iLen);
 }
 
 //If headSize is 0, then there is no header to parse msglength,
@@ -66,7 +157,7 @@ bool SocketStreamerBase::hasUnreadMsg(int iHeadSize)
 	if ( iBytes == 0 ) return false;
 	if (iHeadSize > 0 && iBytes < iHeadSize )
         return (sMsgBuffer[iPos]=='0' || sMsgBuffer[iPos]=='1');
-    return (iHeadSize == 0)? true:(iCalculateMsgSize() < iBytes);
+    return (iHeadSize == 0)? true:(iCalculateMsgSize() <= iBytes);
 }
 
 int SocketStreamerBase::iReadNonBlockingN(char * sMsg, int iMaxLen, int iHeadSize, bool skipNL)
@@ -75,72 +166,64 @@ int SocketStreamerBase::iReadNonBlockingN(char * sMsg, int iMaxLen, int iHeadSiz
 		return ERROR_INVALID_BUFFER_LEN;
 	}
 
+	const char * pMsg = NULL;
+	int iMsgLen = iReadView(pMsg, iMaxLen, iHeadSize, skipNL);
+	if (iMsgLen < 0) {
+		//Return what fits if buffer not big enough
+		if (iMsgLen == ERROR_TARGET_BUFFER_OVERFLOW && pMsg != NULL)
+			memcpy(sMsg, pMsg, ((iMaxLen<iBytes)?iMaxLen:iBytes) );
+		return iMsgLen;
+	}
+	memcpy(sMsg, pMsg, iMsgLen);
+	ReleaseView();
+	return iMsgLen;
+}
+
+int SocketStreamerBase::iReadView(const char *& pMsg, int iMaxLen, int iHeadSize, bool skipNL, bool bHold)
+{
+	int iRC;
+	pMsg = NULL;
+	if (!bHold) ReleaseView();
+
 	int iPad = 0 ;		// Do we need to
 	if (skipNL) {		// skip unnecessary
 		++iPad ;		// New Lines
 	}
 
-	if (iBytes > 0) {
-		if ((iBufferSize - iPos) < iMaxLen + iPad) {
-            //Move buffer contents to make space for new message if needed
-			memmove(sMsgBuffer, &sMsgBuffer[iPos], iBytes) ;
-			iPos = 0;
-		}
-	} else {
-		iPos = 0;
-	}
-
     //This function will be used for delimited (NewLine) messages
     if (iHeadSize == 0)
     {
-        if (iPos > 0) memmove(sMsgBuffer, &sMsgBuffer[iPos], iBytes) ;
         int iNL = 0;
-        iPos = 0;
-        
         do
         {
             for (;iNL<iBytes;iNL++)
-                if (sMsgBuffer[iNL] == '\n')
+                if (sMsgBuffer[iPos + iNL] == '\n')
                     break;
-            
-            if (iNL == iBytes)
-            {
-                if (iBytes >= iBufferSize)  return ERROR_TARGET_BUFFER_OVERFLOW;
-                int count = read(iSockFD, &sMsgBuffer[iBytes], iBufferSize - iBytes);
-                if (count <= 0) return (errno == EAGAIN)? ERROR_EAGAIN:ERROR_SOCKET_READ;
-                iBytes += count;
-            }
-            else
-            {
-                memcpy(sMsg, sMsgBuffer, iNL) ;
-                iBytes -= (iNL+1);
-                memcpy(sMsgBuffer, &sMsgBuffer[iNL+1], iBytes);
-                return iNL;
-            }
+
+            if (iNL < iBytes) break;
+            if ((iRC = iFill()) < 0)
+                return (iRC == ERROR_BUFFER_FULL)? ERROR_TARGET_BUFFER_OVERFLOW: iRC;
         } while (true);
-        return ERROR_BUFFER_FULL;
+
+        pMsg = &sMsgBuffer[iPos];
+        if (iNL > iMaxLen) return ERROR_TARGET_BUFFER_OVERFLOW;
+        //held first, so that consuming the last unread byte does not rewind under the view
+        iHeld += iNL + 1;
+        Consume(iNL + 1);
+        return iNL;
     }
-    
+
     //This function will be used for fixed length messages that have type or length in the headers
 	int header = 1 ;
 	do {
 		while(iBytes < header) {
-			int count = 0 ;
-			if((count = read(iSockFD, &sMsgBuffer[iPos + iBytes], iBufferSize - (iPos + iBytes))) <= 0) {
-				if(errno != EAGAIN) {
-					perror( "SocketStreamerBase::iReadNonBlocking(N)" );
-					return ERROR_SOCKET_READ;
-				}
-				return ERROR_EAGAIN;
-			}
-			iBytes += count ;
+			if ((iRC = iFill()) < 0) return iRC;
 		}
 
         if (header == 1 && !(sMsgBuffer[iPos]=='0' || sMsgBuffer[iPos]=='1')) {
 			header  = iHeadSize ;
 		}
 	} while(iBytes < header) ;
-	 //std::cout << iPad << "," << iPos << "," << iBytes << ","<< iHeadSize << std::endl;
      //Get size of message based on next header.
      //If invalid messages length, return error message.
 	int iMsgLen = iCalculateMsgSize();
@@ -150,32 +233,19 @@ int SocketStreamerBase::iReadNonBlockingN(char * sMsg, int iMaxLen, int iHeadSiz
 
 	 //Return error if buffer not big enough
 	if (iMaxLen < iMsgLen ) {
-		memcpy(sMsg, &sMsgBuffer[iPos], ((iMaxLen<iBytes)?iMaxLen:iBytes) );
+		pMsg = &sMsgBuffer[iPos];
 		return ERROR_TARGET_BUFFER_OVERFLOW;
 	}
 
 	//If no complete message found, read from socket
-	while (iBytes < iMsgLen + iPad && iBytes < iBufferSize) {
-		int count = 0 ;
-		if((count = read(iSockFD, &sMsgBuffer[iPos + iBytes], iBufferSize - (iPos + iBytes))) <= 0) {
-			if(errno != EAGAIN) {
-				perror( "SocketStreamerBase::iReadNonBlocking(N)\n" );
-	    		return ERROR_SOCKET_READ;
-			}
-			return ERROR_EAGAIN;
-		}
-		iBytes += count ;
-	}
-
-	if (iBytes >= iMsgLen + iPad) {
-		memcpy(sMsg, &sMsgBuffer[iPos], iMsgLen) ;
-		iBytes -= iMsgLen + iPad ;
-		iPos += iMsgLen + iPad ;
-		return iMsgLen ;
+	while (iBytes < iMsgLen + iPad) {
+		if ((iRC = iFill()) < 0) return iRC;
 	}
 
-	//Buffer must be full, return error
-	return ERROR_BUFFER_FULL;
+	pMsg = &sMsgBuffer[iPos];
+	iHeld += iMsgLen + iPad;
+	Consume(iMsgLen + iPad);
+	return iMsgLen ;
 }
 
 /*
@@ -201,7 +271,9 @@ int SocketStreamerBase::iWriteNonBlockingN( const char * sMsg, int iLen, int & i
   	iLeft = iLen;
   	while( iLeft > 0 )
     {
-      	if( ( iWritten = write( iSockFD, ptr, iLeft ) ) <= 0 )
+      	iWritten = write( iSockFD, ptr, iLeft );
+		StatAdd(pCounters->iWriteCalls);
+      	if( iWritten <= 0 )
 		{
 			if( errno != EWOULDBLOCK )
 			{
@@ -210,10 +282,14 @@ int SocketStreamerBase::iWriteNonBlockingN( const char * sMsg, int iLen, int & i
 			}
 			else
 			{
+				StatAdd(pCounters->iWriteEagain);
 				iAmountWritten = iLen - iLeft;
 				return ERROR_EWOULDBLOCK;
 			}
 		}
+		StatAdd(pCounters->iBytesOut, iWritten);
+		if( (size_t) iWritten < iLeft )
+			StatAdd(pCounters->iPartialWrites);
 
       	iLeft -= iWritten;
       	ptr += iWritten;
@@ -223,17 +299,86 @@ int SocketStreamerBase::iWriteNonBlockingN( const char * sMsg, int iLen, int & i
   	return iLen;
 }
 
+/*
+ * 	Gather write NonBlocking, one writev for all the buffers
+ *      return bytes written (may be short of the total)
+ *      return ERROR_EWOULDBLOCK when nothing could be written
+ */
+int SocketStreamerBase::iWritevNonBlocking( const struct iovec * iov, int iCount )
+{
+	ssize_t iWritten;
+
+	if( iSockFD < 0 )
+		return ERROR_NOT_CONNECTED;
+
+	while ((iWritten = writev(iSockFD, iov, iCount)) < 0)
+	{
+		StatAdd(pCounters->iWriteCalls);
+		if (errno == EINTR) continue;
+		if (errno == EWOULDBLOCK || errno == EAGAIN)
+		{
+			StatAdd(pCounters->iWriteEagain);
+			return ERROR_EWOULDBLOCK;
+		}
+		perror( "SocketStreamerBase::iWritevNonBlocking Message");
+		return ERROR_SOCKET_WRITE;
+	}
+	StatAdd(pCounters->iWriteCalls);
+	StatAdd(pCounters->iBytesOut, iWritten);
+	size_t iTotal = 0;
+	for (int ii = 0; ii < iCount; ii++)
+		iTotal += iov[ii].iov_len;
+	if ((size_t) iWritten < iTotal)
+		StatAdd(pCounters->iPartialWrites);
+	return (int) iWritten;
+}
+
 int SocketStreamerBase::iPublish( const char * sMsg, int iLen)
 {
+    StatAdd(pCounters->iWriteCalls);
     if (sendto(iSockFD, sMsg, iLen, 0, (struct sockaddr*)&socket_addr, sizeof(socket_addr)) < 0)
     {
         //std::cout << " Error multicasting message." << std::endl;
         perror("Error multicasting message: ");
         return -1;
     }
+    StatAdd(pCounters->iBytesOut, iLen);
     return 0;
 }
 
+//One datagram per iovec, sent with sendmmsg in chunks. Returns the count sent or -1
+int SocketStreamerBase::iPublishBatch( const struct iovec * Msgs, int iCount)
+{
+    static const int CHUNK = 64;
+    struct mmsghdr hdrs[CHUNK];
+    int iSent = 0;
+    while (iSent < iCount)
+    {
+        int n = (iCount - iSent < CHUNK)? iCount - iSent: CHUNK;
+        memset(hdrs, 0, sizeof(struct mmsghdr) * n);
+        for (int ii = 0; ii < n; ii++)
+        {
+            hdrs[ii].msg_hdr.msg_name    = &socket_addr;
+            hdrs[ii].msg_hdr.msg_namelen = sizeof(socket_addr);
+            hdrs[ii].msg_hdr.msg_iov     = (struct iovec *) &Msgs[iSent + ii];
+            hdrs[ii].msg_hdr.msg_iovlen  = 1;
+        }
+        int iRC = sendmmsg(iSockFD, hdrs, n, 0);
+        StatAdd(pCounters->iWriteCalls);
+        if (iRC < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("Error multicasting message: ");
+            return (iSent > 0)? iSent: -1;
+        }
+        for (int ii = 0; ii < iRC; ii++)
+            StatAdd(pCounters->iBytesOut, hdrs[ii].msg_len);
+        iSent += iRC;
+        if (iRC < n) break;
+    }
+    return iSent;
+}
+
 const char *SocketStreamerBase::ErrStr( const int iErrNo )
 {
     static struct err
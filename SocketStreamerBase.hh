@@ -16,6 +16,57 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+
+//External byte source for a streamer (eg) completions of an io_uring receive.
+//iRead returns bytes copied, 0 at end of stream or -1 with errno EAGAIN when empty.
+class StreamSource
+{
+    public:
+        virtual ~StreamSource() {}
+        virtual int iRead(char * sBuf, int iLen) = 0;
+};
+
+//Stats are written by the owning thread only. Relaxed atomic stores let any other
+//thread take a snapshot without locks (StatSnapshot needs all uint64_t members).
+inline void StatAdd(uint64_t & iStat, uint64_t iValue = 1)
+{
+	__atomic_store_n(&iStat, iStat + iValue, __ATOMIC_RELAXED);
+}
+
+inline void StatSet(uint64_t & iStat, uint64_t iValue)
+{
+	__atomic_store_n(&iStat, iValue, __ATOMIC_RELAXED);
+}
+
+template <typename T> void StatSnapshot(const T & Stats, T & Snapshot)
+{
+	const uint64_t * pFrom = (const uint64_t *) &Stats;
+	uint64_t * pTo = (uint64_t *) &Snapshot;
+	for (size_t ii = 0; ii < sizeof(T) / sizeof(uint64_t); ii++)
+		pTo[ii] = __atomic_load_n(&pFrom[ii], __ATOMIC_RELAXED);
+}
+
+//Copies stats into a block other threads snapshot, (eg) stats of an object they cannot reach
+template <typename T> void StatPublish(const T & Stats, T & Published)
+{
+	const uint64_t * pFrom = (const uint64_t *) &Stats;
+	uint64_t * pTo = (uint64_t *) &Published;
+	for (size_t ii = 0; ii < sizeof(T) / sizeof(uint64_t); ii++)
+		__atomic_store_n(&pTo[ii], pFrom[ii], __ATOMIC_RELAXED);
+}
+
+//Syscall level counters of a streamer
+struct StreamCounters
+{
+	uint64_t iBytesIn;
+	uint64_t iReadCalls;
+	uint64_t iReadEagain;
+	uint64_t iBytesOut;
+	uint64_t iWriteCalls;
+	uint64_t iWriteEagain;
+	uint64_t iPartialWrites;    //writes the socket took only part of
+};
 
 class SocketStreamerBase
 {
@@ -47,8 +98,15 @@ class SocketStreamerBase
 		virtual ~SocketStreamerBase();
 
 		int iReadNonBlockingN(char* sMsg, int iMaxLen, int iHeaderSize, bool iSkipDelimiter = 0) ;
+		//Zero copy read, pMsg points into the receive buffer and stays valid until the
+		//next read on this streamer or ReleaseView. Returns the length or ERROR_*
+		//With bHold earlier views are kept too, so a burst can be handed out at once.
+		int iReadView(const char *& pMsg, int iMaxLen, int iHeaderSize, bool iSkipDelimiter = 0, bool bHold = false) ;
+		void ReleaseView();
         int iWriteNonBlockingN( const char * sMsg, int iLen, int & iAmountWritten );
+        int iWritevNonBlocking( const struct iovec * iov, int iCount );
         int iPublish(const char * sMsg, int iLen);
+        int iPublishBatch(const struct iovec * Msgs, int iCount);
 		bool hasUnreadMsg(int iHeadSize);
     
 		virtual int iCalculateMsgSize() { return 0; };
@@ -57,7 +115,14 @@ class SocketStreamerBase
         void SetMultiCastAddress(struct sockaddr_in addr) { socket_addr = addr; }
 
 		int iGetSocket() const          { return iSockFD; }
+		//receive buffer is double mapped (memfd), messages never wrap
+		bool isMirrored() const         { return bMirrored; }
+		//reads go to the source instead of the socket when set
+		void SetSource(StreamSource * pSrc) { pSource = pSrc; }
 		void SetDelimiter(char cDel)    { cDelimiter = cDel; }
+		//counters go to the given struct (eg) one owned by the selector session, NULL for our own
+		void SetCounters(StreamCounters * pStats) { pCounters = (pStats != NULL)? pStats: &Counters; }
+		void GetCounters(StreamCounters & Snapshot) const { StatSnapshot(*pCounters, Snapshot); }
 
 	protected:
         int iBufferSize;
@@ -66,11 +131,20 @@ class SocketStreamerBase
 		//char * sWriteBuffer;
 		int iPos;
 		int iBytes;
+		int iHeld;      //consumed bytes behind iPos still referenced by views
+		bool bMirrored;
 
 	private:
 		int iSockFD;
+        StreamSource * pSource;
+        StreamCounters Counters;
+        StreamCounters * pCounters;
         struct sockaddr_in socket_addr;
 		void CreateBuffer();
+		void ReleaseBuffer();
+		void Consume(int iLen);
+		int iFill();
+		int iRecv(char * sBuf, int iLen);
 		SocketStreamerBase& operator=(const SocketStreamerBase &); 	//assigment op
 		SocketStreamerBase(const SocketStreamerBase &);				//copy constructor
 };
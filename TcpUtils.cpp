@@ -19,16 +19,20 @@
  * \param interface - interface to listen on
  * \param port - port to listen on
  * \param accept_socket - reference to store listening socket 
+ * \param reuse_port - SO_REUSEPORT, the kernel spreads connections over the sockets bound to the port
  *
  * \return 0 if succesful
  * \return < 0 if error
  */
-int32_t InitializeAcceptSocketTCP(const char * interface, in_port_t port, int & accept_socket)
+int32_t InitializeAcceptSocketTCP(const char * interface, in_port_t port, int & accept_socket, bool reuse_port)
 {
     if ((accept_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
         return SOCKET_CREATE_TCP_UTILS_ERROR;
         
     setSocketReuse(accept_socket);
+    int flag = 1;
+    if (reuse_port && setsockopt(accept_socket, SOL_SOCKET, SO_REUSEPORT, (char *) &flag, sizeof(int)) < 0)
+        return BIND_TCP_UTILS_ERROR;
 
     struct sockaddr_in address;
     memset(&address, '\0', sizeof(address));
@@ -19,7 +19,7 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 
-int32_t InitializeAcceptSocketTCP(const char * interface, in_port_t port, int & accept_socket);
+int32_t InitializeAcceptSocketTCP(const char * interface, in_port_t port, int & accept_socket, bool reuse_port = false);
 int32_t acceptConnectionTCP(int accept_socket, int & client_socket, sockaddr_in & client_address);
 int32_t connectTCP(const char * host, in_port_t port, int & sock);
 void disconnectTCP(int sock);
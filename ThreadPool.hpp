@@ -1,101 +1,778 @@
 #pragma once
 
 #include <vector>
-#include <queue>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+#include <string>
+#include <cerrno>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 /*
-Simple synchrnonized queue to parallelize the tasks
+Lock free task pool to parallelize the tasks
 Usage:
     ThreadPool pool(4);
     auto result = pool.enqueue([](int answer) { return answer; }, 42);
     std::cout << result.get() << std::endl;
+    pool.post([]{ work(); });   // fire and forget, no allocation for small callables
+
+Work stealing mode for fork-join work:
+    ThreadPool pool(4, 4096, ThreadPool::WorkStealing);
+    pool.parallel_for(0, n, 1024, [&](size_t i) { out[i] = f(in[i]); });
+    ThreadPool::TaskGroup group;
+    pool.spawn(group, []{ left(); });
+    right();
+    pool.sync(group);
+
+Pinned busy-poll workers for latency critical stages:
+    ThreadPool::Config config(2);
+    config.cpus = {2, 3};       // isolated cores
+    config.priority = 10;       // SCHED_FIFO, needs CAP_SYS_NICE
+    config.busy_poll = true;    // never park on the condition variable
+    config.name = "md";         // threads show up as md-0, md-1
+    ThreadPool pool(config);
+*/
+
+inline void cpu_relax()
+{
+#if defined(__i386) || defined(__x86_64)
+    __builtin_ia32_pause();
+#endif
+}
+
+/*
+Move only void() callable. Callables upto InlineSize bytes are stored in place,
+larger ones go to the heap.
+*/
+class Task
+{
+    public:
+        enum { InlineSize = 48 };
+
+        Task() : ops(nullptr) {}
+
+        template<class F, class = typename std::enable_if<
+            !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+        Task(F&& f) : ops(nullptr)
+        {
+            typedef typename std::decay<F>::type Fn;
+            construct<Fn>(std::forward<F>(f), std::integral_constant<bool,
+                sizeof(Fn) <= InlineSize && alignof(Fn) <= alignof(Storage) &&
+                std::is_nothrow_move_constructible<Fn>::value>());
+        }
+
+        Task(Task&& other) noexcept : ops(other.ops)
+        {
+            if (ops) ops->move(&other.storage, &storage);
+            other.ops = nullptr;
+        }
+
+        Task& operator=(Task&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                ops = other.ops;
+                if (ops) ops->move(&other.storage, &storage);
+                other.ops = nullptr;
+            }
+            return *this;
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        ~Task() { reset(); }
+
+        void operator()() { ops->invoke(&storage); }
+        explicit operator bool() const { return ops != nullptr; }
+
+        void reset()
+        {
+            if (ops) ops->destroy(&storage);
+            ops = nullptr;
+        }
+
+    private:
+        typedef typename std::aligned_storage<InlineSize, alignof(std::max_align_t)>::type Storage;
+
+        struct Ops
+        {
+            void (*invoke)(void *);
+            void (*move)(void *from, void *to);
+            void (*destroy)(void *);
+        };
+
+        template<class Fn> struct InlineOps
+        {
+            static void invoke(void *p) { (*static_cast<Fn *>(p))(); }
+            static void move(void *from, void *to)
+            {
+                new (to) Fn(std::move(*static_cast<Fn *>(from)));
+                static_cast<Fn *>(from)->~Fn();
+            }
+            static void destroy(void *p) { static_cast<Fn *>(p)->~Fn(); }
+            static const Ops table;
+        };
+
+        template<class Fn> struct HeapOps
+        {
+            static void invoke(void *p) { (**static_cast<Fn **>(p))(); }
+            static void move(void *from, void *to) { *static_cast<Fn **>(to) = *static_cast<Fn **>(from); }
+            static void destroy(void *p) { delete *static_cast<Fn **>(p); }
+            static const Ops table;
+        };
+
+        template<class Fn, class F> void construct(F&& f, std::true_type)
+        {
+            new (&storage) Fn(std::forward<F>(f));
+            ops = &InlineOps<Fn>::table;
+        }
+
+        template<class Fn, class F> void construct(F&& f, std::false_type)
+        {
+            *reinterpret_cast<Fn **>(&storage) = new Fn(std::forward<F>(f));
+            ops = &HeapOps<Fn>::table;
+        }
+
+        Storage storage;
+        const Ops * ops;
+};
+
+template<class Fn> const Task::Ops Task::InlineOps<Fn>::table =
+    { &Task::InlineOps<Fn>::invoke, &Task::InlineOps<Fn>::move, &Task::InlineOps<Fn>::destroy };
+template<class Fn> const Task::Ops Task::HeapOps<Fn>::table =
+    { &Task::HeapOps<Fn>::invoke, &Task::HeapOps<Fn>::move, &Task::HeapOps<Fn>::destroy };
+
+/*
+Bounded multi producer multi consumer queue (Dmitry Vyukov's design).
+Every cell carries a sequence number, so producers and consumers only contend
+on their own position counter. Capacity is rounded up to a power of two.
+*/
+template<class T>
+class MPMCQueue
+{
+    public:
+        explicit MPMCQueue(size_t size) : mask(roundup(size) - 1), cells(new Cell[mask + 1])
+        {
+            for (size_t i = 0; i <= mask; ++i)
+                cells[i].seq.store(i, std::memory_order_relaxed);
+            enqueue_pos.store(0, std::memory_order_relaxed);
+            dequeue_pos.store(0, std::memory_order_relaxed);
+        }
+
+        ~MPMCQueue()
+        {
+            T item;
+            while (try_pop(item)) {}
+        }
+
+        MPMCQueue(const MPMCQueue&) = delete;
+        MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+        bool try_push(T&& item)
+        {
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Cell &cell = cells[pos & mask];
+                size_t seq = cell.seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if (diff == 0)
+                {
+                    if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        new (&cell.storage) T(std::move(item));
+                        cell.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                    return false; // full queue
+                else
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        bool try_pop(T& item)
+        {
+            size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Cell &cell = cells[pos & mask];
+                size_t seq = cell.seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+                if (diff == 0)
+                {
+                    if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        T *data = reinterpret_cast<T *>(&cell.storage);
+                        item = std::move(*data);
+                        data->~T();
+                        cell.seq.store(pos + mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                    return false; // empty queue
+                else
+                    pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        // approximate when other threads are active
+        bool empty() const
+        {
+            return enqueue_pos.load(std::memory_order_seq_cst) == dequeue_pos.load(std::memory_order_seq_cst);
+        }
+
+        size_t capacity() const { return mask + 1; }
+
+    private:
+        static size_t roundup(size_t size)
+        {
+            size_t cap = 2;
+            while (cap < size) cap <<= 1;
+            return cap;
+        }
+
+        struct Cell
+        {
+            std::atomic<size_t> seq;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        };
+
+        const size_t mask;
+        std::unique_ptr<Cell[]> cells;
+        alignas(64) std::atomic<size_t> enqueue_pos;
+        alignas(64) std::atomic<size_t> dequeue_pos;
+};
+
+/*
+Chase-Lev work stealing deque (fixed capacity). The owner pushes and pops at the
+bottom, thieves steal from the top. Items are owned by the caller.
 */
-class ThreadPool 
+template<class T>
+class WorkStealingDeque
 {
     public:
-        ThreadPool(size_t);
-        
+        explicit WorkStealingDeque(size_t size = 8192) : mask(size - 1), items(new std::atomic<T *>[size]), top(0), bottom(0)
+        {
+            if (size < 2 || (size & mask) != 0)
+                throw std::invalid_argument("WorkStealingDeque size must be a power of two");
+        }
+
+        WorkStealingDeque(const WorkStealingDeque&) = delete;
+        WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+        // owner only, false when full
+        bool push(T *item)
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_acquire);
+            if (b - t > (int64_t)mask) return false;
+            items[b & mask].store(item, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // owner only, newest item first
+        T * pop()
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top.load(std::memory_order_relaxed);
+            if (t > b)
+            {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            T *item = items[b & mask].load(std::memory_order_relaxed);
+            if (t == b)
+            {
+                // last item, race against thieves
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    item = nullptr;
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        // any thread, oldest item first
+        T * steal()
+        {
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom.load(std::memory_order_acquire);
+            if (t >= b) return nullptr;
+            T *item = items[t & mask].load(std::memory_order_relaxed);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr; // lost the race
+            return item;
+        }
+
+        bool empty() const
+        {
+            return bottom.load(std::memory_order_seq_cst) <= top.load(std::memory_order_seq_cst);
+        }
+
+    private:
+        const size_t mask;
+        std::unique_ptr<std::atomic<T *>[]> items;
+        // padded rather than aligned, deques are heap allocated
+        char pad0[64];
+        std::atomic<int64_t> top;
+        char pad1[64 - sizeof(std::atomic<int64_t>)];
+        std::atomic<int64_t> bottom;
+};
+
+class ThreadPool
+{
+    public:
+        enum Mode { SharedQueue, WorkStealing };
+
+        // pending count of spawned tasks, sync waits for it to drain
+        class TaskGroup
+        {
+            friend class ThreadPool;
+            public:
+                TaskGroup() : pending(0) {}
+                TaskGroup(const TaskGroup&) = delete;
+                TaskGroup& operator=(const TaskGroup&) = delete;
+            private:
+                std::atomic<int> pending;
+        };
+
+        // settings of one worker thread
+        struct WorkerConfig
+        {
+            WorkerConfig() : cpu(-1), priority(0), busy_poll(false), spin_count(1024), yield_count(16) {}
+            int cpu;            // cpu to pin to, -1 leaves the thread unpinned
+            int priority;       // SCHED_FIFO priority, 0 keeps the default scheduler
+            bool busy_poll;     // spin and yield when idle instead of parking
+            int spin_count;     // cpu_relax spins before yielding
+            int yield_count;    // yields before parking
+            std::string name;   // thread name, at most 15 characters are kept
+        };
+
+        // pool wide settings, workers[i] (when given) overrides them for worker i
+        struct Config
+        {
+            explicit Config(size_t threads = 1)
+                : threads(threads), queue_size(4096), mode(SharedQueue), priority(0),
+                  busy_poll(false), spin_count(1024), yield_count(16) {}
+            size_t threads;
+            size_t queue_size;  // bounds the pending tasks, producers wait when it is full
+            Mode mode;
+            std::vector<int> cpus;  // worker i is pinned to cpus[i % cpus.size()], empty for unpinned
+            int priority;
+            bool busy_poll;
+            int spin_count;
+            int yield_count;
+            std::string name;   // thread name prefix, workers are named name-i
+            std::vector<WorkerConfig> workers;
+
+            WorkerConfig worker(size_t i) const;
+        };
+
+        // queue_size bounds the pending tasks, producers wait when it is full.
+        // WorkStealing mode gives every worker a deque for spawned tasks,
+        // pin places worker i on cpu i (modulo the cpu count).
+        ThreadPool(size_t threads, size_t queue_size = 4096, Mode mode = SharedQueue, bool pin = false);
+        explicit ThreadPool(const Config& config);
+
         template<class F, class... Args>
-        auto enqueue(F&& f, Args&&... args) 
+        auto enqueue(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
+
+        // runs f without a future
+        template<class F>
+        void post(F&& f);
+
+        // runs f as part of group. Called from a worker in WorkStealing mode the
+        // task goes to the worker's own deque, otherwise to the shared queue.
+        template<class F>
+        void spawn(TaskGroup& group, F&& f);
+
+        // waits for the tasks of group, running pending tasks meanwhile
+        void sync(TaskGroup& group);
+
+        // calls f(i) for i in [begin, end), splitting the range recursively down to grain
+        template<class F>
+        void parallel_for(size_t begin, size_t end, size_t grain, F f);
+
+        size_t size() const { return workers.size(); }
+
+        // 0 when the affinity, priority and name of worker i were applied, otherwise the failing errno
+        int status(size_t worker) const { return statuses[worker]; }
+
         ~ThreadPool();
     private:
+        struct Worker
+        {
+            ThreadPool *pool;
+            size_t index;
+        };
+
+        template<class F> struct GroupTask
+        {
+            TaskGroup *group;
+            F f;
+            void operator()()
+            {
+                f();
+                group->pending.fetch_sub(1, std::memory_order_release);
+            }
+        };
+
+        template<class F> struct RangeTask
+        {
+            ThreadPool *pool;
+            TaskGroup *group;
+            size_t begin, end, grain;
+            F f;
+            void operator()() { pool->split_range(*group, begin, end, grain, f); }
+        };
+
+        static Worker *& current()
+        {
+            static thread_local Worker *worker = nullptr;
+            return worker;
+        }
+
+        void push(Task&& task);
+        void wake();
+        bool try_get(Task& task, size_t self);
+        bool wait_for_task(Task& task, size_t self);
+        void start(const Config& config);
+        static int configure(std::thread& thread, const WorkerConfig& config);
+        template<class F>
+        void split_range(TaskGroup& group, size_t begin, size_t end, size_t grain, F& f);
+
+        static const size_t NoWorker = (size_t)-1;
+
         // need to keep track of threads so we can join them
         std::vector< std::thread > workers;
+        std::vector< WorkerConfig > settings;
+        std::vector< int > statuses;
         // the task queue
-        std::queue< std::function<void()> > tasks;
-    
-        // synchronization
-        std::mutex queue_mutex;
+        MPMCQueue< Task > tasks;
+        // per worker deques of spawned tasks (WorkStealing mode)
+        std::vector< std::unique_ptr< WorkStealingDeque<Task> > > deques;
+
+        // synchronization, the mutex is only taken to park and wake idle workers
+        std::mutex park_mutex;
         std::condition_variable condition;
-        bool stop;
+        std::atomic<int> sleepers;
+        std::atomic<bool> stop;
 };
- 
+
+inline ThreadPool::WorkerConfig ThreadPool::Config::worker(size_t i) const
+{
+    if (i < workers.size())
+        return workers[i];
+    WorkerConfig config;
+    if (!cpus.empty()) config.cpu = cpus[i % cpus.size()];
+    config.priority = priority;
+    config.busy_poll = busy_poll;
+    config.spin_count = spin_count;
+    config.yield_count = yield_count;
+    if (!name.empty()) config.name = name + "-" + std::to_string(i);
+    return config;
+}
+
 // the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(size_t threads)
-    :   stop(false)
+inline ThreadPool::ThreadPool(size_t threads, size_t queue_size, Mode mode, bool pin)
+    :   tasks(queue_size), sleepers(0), stop(false)
 {
-    for(size_t i = 0;i<threads;++i)
+    Config config(threads);
+    config.queue_size = queue_size;
+    config.mode = mode;
+    if (pin)
+        for (unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); ++i)
+            config.cpus.push_back(i);
+    start(config);
+}
+
+inline ThreadPool::ThreadPool(const Config& config)
+    :   tasks(config.queue_size), sleepers(0), stop(false)
+{
+    start(config);
+}
+
+inline void ThreadPool::start(const Config& config)
+{
+    if (config.mode == WorkStealing)
+        for(size_t i = 0;i<config.threads;++i)
+            deques.emplace_back(new WorkStealingDeque<Task>());
+
+    for(size_t i = 0;i<config.threads;++i)
+        settings.push_back(config.worker(i));
+
+    for(size_t i = 0;i<config.threads;++i)
+    {
         workers.emplace_back(
-            [this]
+            [this, i]
             {
-                for(;;)
+                Worker self = { this, i };
+                current() = &self;
+                Task task;
+                while (wait_for_task(task, i))
                 {
-                    std::function<void()> task;
-
-                    {
-                        std::unique_lock<std::mutex> lock(this->queue_mutex);
-                        this->condition.wait(lock,
-                            [this]{ return this->stop || !this->tasks.empty(); });
-                        if(this->stop && this->tasks.empty())
-                            return;
-                        task = std::move(this->tasks.front());
-                        this->tasks.pop();
-                    }
-
                     task();
+                    task.reset();
                 }
+                current() = nullptr;
             }
         );
+        statuses.push_back(configure(workers.back(), settings[i]));
+    }
+}
+
+// applies the affinity, scheduler and name, returns the first failing errno
+inline int ThreadPool::configure(std::thread& thread, const WorkerConfig& config)
+{
+    int status = 0;
+#ifdef __linux__
+    pthread_t handle = thread.native_handle();
+    if (config.cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(config.cpu, &cpus);
+        int rc = pthread_setaffinity_np(handle, sizeof(cpus), &cpus);
+        if (rc != 0 && status == 0) status = rc;
+    }
+    if (config.priority > 0)
+    {
+        sched_param param;
+        param.sched_priority = config.priority;
+        int rc = pthread_setschedparam(handle, SCHED_FIFO, &param);
+        if (rc != 0 && status == 0) status = rc;
+    }
+    if (!config.name.empty())
+    {
+        int rc = pthread_setname_np(handle, config.name.substr(0, 15).c_str());
+        if (rc != 0 && status == 0) status = rc;
+    }
+#else
+    (void)thread;
+    if (config.cpu >= 0 || config.priority > 0 || !config.name.empty())
+        status = ENOTSUP;
+#endif
+    return status;
+}
+
+// own deque first (newest), then the shared queue, then steal (oldest) from the others
+inline bool ThreadPool::try_get(Task& task, size_t self)
+{
+    if (self != NoWorker && !deques.empty())
+    {
+        Task *item = deques[self]->pop();
+        if (item)
+        {
+            task = std::move(*item);
+            delete item;
+            return true;
+        }
+    }
+    if (tasks.try_pop(task)) return true;
+    for (size_t i = 1; i <= deques.size(); ++i)
+    {
+        size_t victim = (self == NoWorker)? i - 1: (self + i) % deques.size();
+        if (victim == self) continue;
+        Task *item = deques[victim]->steal();
+        if (item)
+        {
+            task = std::move(*item);
+            delete item;
+            return true;
+        }
+    }
+    return false;
+}
+
+// spin, then yield, then park until a task arrives. Returns false when stopped and drained.
+inline bool ThreadPool::wait_for_task(Task& task, size_t self)
+{
+    for (;;)
+    {
+        const WorkerConfig& config = settings[self];
+        for (int i = 0; i < config.spin_count; ++i)
+        {
+            if (try_get(task, self)) return true;
+            cpu_relax();
+        }
+        for (int i = 0; i < config.yield_count; ++i)
+        {
+            if (try_get(task, self)) return true;
+            std::this_thread::yield();
+        }
+
+        auto idle = [this]
+        {
+            if (!tasks.empty()) return false;
+            for (auto &deque : deques)
+                if (!deque->empty()) return false;
+            return true;
+        };
+        if (config.busy_poll)
+        {
+            // keep polling, only leave when stopped and drained
+            if (stop.load(std::memory_order_acquire) && idle())
+                return false;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(park_mutex);
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        condition.wait(lock, [this, &idle]{ return stop.load() || !idle(); });
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+        if (stop.load() && idle())
+            return false;
+    }
+}
+
+inline void ThreadPool::wake()
+{
+    // pairs with the seq_cst increment of a parking worker
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed) > 0)
+    {
+        { std::lock_guard<std::mutex> lock(park_mutex); }
+        condition.notify_one();
+    }
+}
+
+inline void ThreadPool::push(Task&& task)
+{
+    // don't allow enqueueing after stopping the pool
+    if(stop.load(std::memory_order_relaxed))
+        throw std::runtime_error("enqueue on stopped ThreadPool");
+
+    // a worker posting into a full queue runs pending tasks instead of waiting,
+    // otherwise workers that all post from inside tasks would wait on each other
+    Worker *worker = current();
+    size_t self = (worker != nullptr && worker->pool == this)? worker->index: NoWorker;
+    Task pending;
+    while (!tasks.try_push(std::move(task)))
+    {
+        if (self != NoWorker && try_get(pending, self))
+        {
+            pending();
+            pending.reset();
+        }
+        else
+            std::this_thread::yield();
+    }
+    wake();
 }
 
 // add new work item to the pool
 template<class F, class... Args>
-auto ThreadPool::enqueue(F&& f, Args&&... args) 
+auto ThreadPool::enqueue(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type>
 {
     using return_type = typename std::result_of<F(Args...)>::type;
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >(
+    std::packaged_task<return_type()> task(
             std::bind(std::forward<F>(f), std::forward<Args>(args)...)
         );
-        
-    std::future<return_type> res = task->get_future();
+
+    std::future<return_type> res = task.get_future();
+    push(Task(std::move(task)));
+    return res;
+}
+
+template<class F>
+void ThreadPool::post(F&& f)
+{
+    push(Task(std::forward<F>(f)));
+}
+
+template<class F>
+void ThreadPool::spawn(TaskGroup& group, F&& f)
+{
+    typedef GroupTask<typename std::decay<F>::type> Job;
+    group.pending.fetch_add(1, std::memory_order_relaxed);
+    Worker *worker = current();
+    if (worker != nullptr && worker->pool == this && !deques.empty())
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
+        Task *item = new Task(Job{ &group, std::forward<F>(f) });
+        if (deques[worker->index]->push(item))
+        {
+            wake();
+            return;
+        }
+        // deque full, run it here
+        (*item)();
+        delete item;
+        return;
+    }
+    push(Task(Job{ &group, std::forward<F>(f) }));
+}
 
-        // don't allow enqueueing after stopping the pool
-        if(stop)
-            throw std::runtime_error("enqueue on stopped ThreadPool");
+inline void ThreadPool::sync(TaskGroup& group)
+{
+    Worker *worker = current();
+    size_t self = (worker != nullptr && worker->pool == this)? worker->index: NoWorker;
+    Task task;
+    while (group.pending.load(std::memory_order_acquire) > 0)
+    {
+        if (try_get(task, self))
+        {
+            task();
+            task.reset();
+        }
+        else
+            std::this_thread::yield();
+    }
+}
 
-        tasks.emplace([task](){ (*task)(); });
+template<class F>
+void ThreadPool::split_range(TaskGroup& group, size_t begin, size_t end, size_t grain, F& f)
+{
+    // hand the upper halves to thieves and keep the lowest chunk
+    while (end - begin > grain)
+    {
+        size_t mid = begin + (end - begin) / 2;
+        spawn(group, RangeTask<F>{ this, &group, mid, end, grain, f });
+        end = mid;
     }
-    condition.notify_one();
-    return res;
+    for (size_t i = begin; i < end; ++i)
+        f(i);
+}
+
+template<class F>
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain, F f)
+{
+    if (begin >= end) return;
+    if (grain == 0) grain = 1;
+    TaskGroup group;
+    split_range(group, begin, end, grain, f);
+    sync(group);
 }
 
-// the destructor joins all threads
+// the destructor runs the pending tasks and joins all threads
 inline ThreadPool::~ThreadPool()
 {
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
+        std::unique_lock<std::mutex> lock(park_mutex);
         stop = true;
     }
     condition.notify_all();
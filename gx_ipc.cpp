@@ -6,6 +6,9 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <sys/syscall.h>
+
+#define GX_IPC_MPOL_BIND 2
 
 
 /*
@@ -17,13 +20,17 @@ int iCreateMem( unsigned long lKey, long lSize, long lHugePageSize)
     
     if ( lHugePageSize <= 0 )
         lHugePageSize = 1;
-//    else
-//        permissions |= SHM_HUGETLB;
+    else if ( lHugePageSize > 1 )
+        permissions |= SHM_HUGETLB;
     
     lSize = lSize + (lHugePageSize - (lSize % lHugePageSize));
 
     if (shmget((key_t)lKey, lSize, permissions ) < 0)
     {
+        /* No huge pages available, fall back to normal pages */
+        if ( (permissions & SHM_HUGETLB) &&
+             shmget((key_t)lKey, lSize, permissions & ~SHM_HUGETLB) >= 0 )
+            return 0;
         perror( "shmget" );
         return GX_IPC_ERROR_SHMEMGET;
     }
@@ -31,6 +38,125 @@ int iCreateMem( unsigned long lKey, long lSize, long lHugePageSize)
 	return 0;
 }
 
+/*
+ * Length of the mapping for a policy, a multiple of the (huge) page size
+ */
+static unsigned long lMapSize(unsigned long lSize, const struct MemPolicy * pPolicy)
+{
+    unsigned long lPage = sysconf(_SC_PAGESIZE);
+    if ( pPolicy != NULL && pPolicy->lHugePageSize > (long)lPage )
+        lPage = pPolicy->lHugePageSize;
+    return ((lSize + lPage - 1) / lPage) * lPage;
+}
+
+/*
+ * Validate a policy
+ */
+int iCheckMemPolicy(const struct MemPolicy * pPolicy)
+{
+    if ( pPolicy != NULL && pPolicy->lHugePageSize > 0 &&
+         pPolicy->lHugePageSize != GX_IPC_HUGE_PAGE_2MB && pPolicy->lHugePageSize != GX_IPC_HUGE_PAGE_1GB )
+        return GX_IPC_ERROR_INVALID_HUGE_PAGE_SIZE;
+    return 0;
+}
+
+/*
+ * Allocate private memory as per policy
+ */
+int iAllocMem(void ** pMem, unsigned long lSize, const struct MemPolicy * pPolicy)
+{
+    void * pMap = MAP_FAILED;
+    int iRC;
+    *pMem = NULL;
+
+    if ( (iRC = iCheckMemPolicy(pPolicy)) < 0 )
+        return iRC;
+
+    unsigned long lMapLen = lMapSize(lSize, pPolicy);
+    if ( pPolicy != NULL && pPolicy->lHugePageSize > 0 )
+    {
+        int iShift = (pPolicy->lHugePageSize == GX_IPC_HUGE_PAGE_1GB)? 30:21;
+        pMap = mmap(NULL, lMapLen, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|(iShift << MAP_HUGE_SHIFT), -1, 0);
+
+        /* No huge pages reserved, fall back to transparent huge pages */
+        if (pMap == MAP_FAILED)
+        {
+            pMap = mmap(NULL, lMapLen, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            if (pMap != MAP_FAILED)
+                madvise(pMap, lMapLen, MADV_HUGEPAGE);
+        }
+    }
+    else
+    {
+        pMap = mmap(NULL, lMapLen, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    }
+
+    if (pMap == MAP_FAILED)
+    {
+        perror( "mmap" );
+        return GX_IPC_ERROR_MEMMAP;
+    }
+
+    /* Memory that does not meet the policy (mbind or mlock failed) is not handed out */
+    if ( (iRC = iPrepareMem(pMap, lMapLen, pPolicy)) < 0 )
+    {
+        munmap(pMap, lMapLen);
+        return iRC;
+    }
+
+    *pMem = pMap;
+    return 0;
+}
+
+/*
+ * Release memory allocated by iAllocMem
+ */
+int iFreeMem(void * pMem, unsigned long lSize, const struct MemPolicy * pPolicy)
+{
+    if ( pMem == NULL ) return 0;
+    if (munmap(pMem, lMapSize(lSize, pPolicy)) < 0)
+    {
+        perror( "munmap" );
+        return GX_IPC_ERROR_MUNMAP;
+    }
+    return 0;
+}
+
+/*
+ * Apply numa binding, prefault and mlock settings to existing memory.
+ * Binding is done before the pages are touched so they get allocated on the node.
+ */
+int iPrepareMem(void * pMem, unsigned long lSize, const struct MemPolicy * pPolicy)
+{
+    if ( pMem == NULL || pPolicy == NULL ) return 0;
+
+    if ( pPolicy->iNumaNode >= 0 )
+    {
+        unsigned long lNodeMask = 1UL << pPolicy->iNumaNode;
+        if (syscall(SYS_mbind, pMem, lSize, GX_IPC_MPOL_BIND, &lNodeMask, sizeof(lNodeMask) * 8, 0) < 0)
+        {
+            perror( "mbind" );
+            return GX_IPC_ERROR_MBIND;
+        }
+    }
+
+    if ( pPolicy->bPrefault )
+    {
+        long lPage = sysconf(_SC_PAGESIZE);
+        volatile char * pPage = (volatile char *)pMem;
+        for (unsigned long lOffset = 0; lOffset < lSize; lOffset += lPage)
+            pPage[lOffset] = pPage[lOffset];
+    }
+
+    if ( pPolicy->bLock && mlock(pMem, lSize) < 0 )
+    {
+        perror( "mlock" );
+        return GX_IPC_ERROR_MLOCK;
+    }
+
+    return 0;
+}
 /*
  * Delete shared memory
  */
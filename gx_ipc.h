@@ -19,12 +19,55 @@
 #define GX_IPC_ERROR_MEMMAP      -8
 #define GX_IPC_ERROR_MUNMAP      -9
 #define GX_IPC_ERROR_INVALID_HUGE_PAGE_SIZE -10
+#define GX_IPC_ERROR_MLOCK       -11
+#define GX_IPC_ERROR_MBIND       -12
+
+/*
+ * Huge page sizes
+ */
+#define GX_IPC_HUGE_PAGE_2MB     (2L * 1024 * 1024)
+#define GX_IPC_HUGE_PAGE_1GB     (1024L * 1024 * 1024)
+
+/*
+ * Allocation policy for large buffers (tables, indices, logs).
+ * Huge pages fall back to normal pages (with transparent huge page advice)
+ * when the system has none available.
+ */
+struct MemPolicy
+{
+    long lHugePageSize;     /* 0 for normal pages, else GX_IPC_HUGE_PAGE_2MB or GX_IPC_HUGE_PAGE_1GB */
+    int  bPrefault;         /* touch every page at allocation time */
+    int  bLock;             /* mlock the memory */
+    int  iNumaNode;         /* bind to numa node, -1 for no binding */
+};
 
 /*
  * Create shared memory
  */
 int iCreateMem(unsigned long lKey, long lSize, long lHugePageSize = 1); //
 
+/*
+ * Validate a policy, returns GX_IPC_ERROR_INVALID_HUGE_PAGE_SIZE for an unsupported page size
+ */
+int iCheckMemPolicy(const struct MemPolicy * pPolicy);
+
+/*
+ * Allocate private memory as per policy (NULL policy implies normal pages).
+ * On failure *pMem is NULL and nothing stays mapped.
+ */
+int iAllocMem(void ** pMem, unsigned long lSize, const struct MemPolicy * pPolicy);
+
+/*
+ * Release memory allocated by iAllocMem
+ */
+int iFreeMem(void * pMem, unsigned long lSize, const struct MemPolicy * pPolicy);
+
+/*
+ * Apply numa binding, prefault and mlock settings of the policy to existing memory
+ * (eg) memory attached from shared memory or memmap segments
+ */
+int iPrepareMem(void * pMem, unsigned long lSize, const struct MemPolicy * pPolicy);
+
 /*
  * Delete shared memory
  */
@@ -19,6 +19,38 @@ namespace
 {
 	class ThreadPoolTest : public ::testing::Test { };
 
+	//move only callable
+	struct AddTask
+	{
+        std::atomic<int> *count;
+        std::unique_ptr<int> value;
+        void operator()() { *count += *value; }
+	};
+
+	//fork-join fibonacci through spawn/sync
+	struct Fib
+	{
+        ThreadPool *pool;
+        int n;
+        long *out;
+        void operator()()
+        {
+            if (n < 12)
+            {
+                long a = 0, b = 1;
+                for (int i = 0; i < n; i++) { long t = a + b; a = b; b = t; }
+                *out = a;
+                return;
+            }
+            long x = 0, y = 0;
+            ThreadPool::TaskGroup group;
+            pool->spawn(group, Fib{pool, n - 1, &x});
+            Fib{pool, n - 2, &y}();
+            pool->sync(group);
+            *out = x + y;
+        }
+	};
+
 	TEST_F(ThreadPoolTest, ThreadPoolTest1)
 	{
         ThreadPool pool(4);
@@ -26,6 +58,193 @@ namespace
         std::cout << result.get() << std::endl;
 	}
 
+	TEST_F(ThreadPoolTest, MPMCQueue)
+	{
+        MPMCQueue<int> queue(3);
+        ASSERT_EQ(4u, queue.capacity());
+        for (int i = 0; i < 4; i++)
+            ASSERT_TRUE(queue.try_push(std::move(i)));
+        int full = 5;
+        ASSERT_FALSE(queue.try_push(std::move(full)));
+        int v = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            ASSERT_TRUE(queue.try_pop(v));
+            ASSERT_EQ(i, v);
+        }
+        ASSERT_FALSE(queue.try_pop(v));
+        ASSERT_TRUE(queue.empty());
+	}
+
+	TEST_F(ThreadPoolTest, SmallAndLargeTasks)
+	{
+        std::atomic<int> count(0);
+        {
+            //small queue so producers hit the full queue
+            ThreadPool pool(3, 16);
+            pool.post(AddTask{&count, std::unique_ptr<int>(new int(5))});
+            char big[256] = {1};
+            pool.post([&count, big] { count += big[0]; });
+            for (int i = 0; i < 10000; i++)
+                pool.post([&count] { count++; });
+            auto result = pool.enqueue([](int a, int b) { return a * b; }, 6, 7);
+            ASSERT_EQ(42, result.get());
+        }
+        //destructor runs the pending tasks
+        ASSERT_EQ(10006, count.load());
+	}
+
+	TEST_F(ThreadPoolTest, PostFromWorkers)
+	{
+        //every worker fans out into a queue that is full most of the time
+        std::atomic<int> count(0);
+        {
+            ThreadPool pool(2, 4);
+            for (int t = 0; t < 2; t++)
+                pool.post([&pool, &count]
+                {
+                    for (int i = 0; i < 1000; i++)
+                        pool.post([&count] { count++; });
+                });
+            while (count.load() < 2000)
+                std::this_thread::yield();
+        }
+        ASSERT_EQ(2000, count.load());
+	}
+
+	TEST_F(ThreadPoolTest, TinyTaskThroughput)
+	{
+        const int count = 200000;
+        std::atomic<int> done(0);
+        auto start = std::chrono::steady_clock::now();
+        {
+            ThreadPool pool(4);
+            for (int i = 0; i < count; i++)
+                pool.post([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        ASSERT_EQ(count, done.load());
+        std::cout << count << " tiny tasks in " << ms << " ms" << std::endl;
+	}
+
+	TEST_F(ThreadPoolTest, WorkStealingDeque)
+	{
+        WorkStealingDeque<int> deque(4);
+        int v[5] = {0, 1, 2, 3, 4};
+        ASSERT_TRUE(deque.empty());
+        for (int i = 0; i < 4; i++)
+            ASSERT_TRUE(deque.push(&v[i]));
+        ASSERT_FALSE(deque.push(&v[4]));
+        //thieves take the oldest, the owner the newest
+        ASSERT_EQ(&v[0], deque.steal());
+        ASSERT_EQ(&v[3], deque.pop());
+        ASSERT_EQ(&v[2], deque.pop());
+        ASSERT_EQ(&v[1], deque.steal());
+        ASSERT_EQ(nullptr, deque.pop());
+        ASSERT_EQ(nullptr, deque.steal());
+        ASSERT_TRUE(deque.empty());
+	}
+
+	TEST_F(ThreadPoolTest, SpawnSync)
+	{
+        ThreadPool pool(4, 4096, ThreadPool::WorkStealing);
+        long result = 0;
+        //from outside the pool the tasks go through the shared queue
+        ThreadPool::TaskGroup group;
+        pool.spawn(group, Fib{&pool, 25, &result});
+        pool.sync(group);
+        ASSERT_EQ(75025, result);
+
+        //plain enqueue keeps working in stealing mode
+        auto answer = pool.enqueue([](int a) { return a; }, 42);
+        ASSERT_EQ(42, answer.get());
+	}
+
+	TEST_F(ThreadPoolTest, ParallelFor)
+	{
+        for (int mode = ThreadPool::SharedQueue; mode <= ThreadPool::WorkStealing; mode++)
+        {
+            ThreadPool pool(3, 4096, (ThreadPool::Mode)mode);
+            std::vector<int> hits(10000, 0);
+            pool.parallel_for(0, hits.size(), 64, [&hits](size_t i) { hits[i]++; });
+            for (size_t i = 0; i < hits.size(); i++)
+                ASSERT_EQ(1, hits[i]);
+            //empty range and zero grain
+            pool.parallel_for(5, 5, 0, [&hits](size_t i) { hits[i]++; });
+            pool.parallel_for(0, 3, 0, [&hits](size_t i) { hits[i]++; });
+            ASSERT_EQ(2, hits[0]);
+            ASSERT_EQ(1, hits[5]);
+        }
+	}
+
+	//fork-join scaling from 1 to N pinned workers, compared against the shared queue
+	TEST_F(ThreadPoolTest, StealingScaling)
+	{
+        const size_t n = 1 << 20;
+        std::vector<double> data(n, 1.0);
+        size_t cores = std::max(2u, std::thread::hardware_concurrency());
+        for (size_t threads = 1; threads <= cores; threads *= 2)
+        {
+            for (int mode = ThreadPool::SharedQueue; mode <= ThreadPool::WorkStealing; mode++)
+            {
+                ThreadPool pool(threads, 4096, (ThreadPool::Mode)mode, true);
+                auto start = std::chrono::steady_clock::now();
+                for (int round = 0; round < 4; round++)
+                    pool.parallel_for(0, n, 4096, [&data](size_t i) { data[i] = data[i] * 1.000001 + 0.5; });
+                auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+                std::cout << (mode == ThreadPool::WorkStealing? "stealing ": "shared   ")
+                          << threads << " threads " << us << " us" << std::endl;
+            }
+        }
+        long fib = 0;
+        ThreadPool pool(cores, 4096, ThreadPool::WorkStealing, true);
+        ThreadPool::TaskGroup group;
+        pool.spawn(group, Fib{&pool, 22, &fib});
+        pool.sync(group);
+        ASSERT_EQ(17711, fib);
+	}
+
+	TEST_F(ThreadPoolTest, WorkerConfig)
+	{
+        ThreadPool::Config config(2);
+        config.cpus.push_back(0);
+        config.busy_poll = true;
+        config.spin_count = 64;
+        config.name = "tp-config";
+        //second worker keeps the default scheduler but gets its own name
+        config.workers.resize(2, config.worker(0));
+        config.workers[1].name = "tp-other-worker-long-name";
+        ASSERT_EQ("tp-config-0", config.worker(0).name);
+        ASSERT_EQ(0, config.worker(1).cpu);
+        {
+            ThreadPool pool(config);
+            ASSERT_EQ(2u, pool.size());
+            ASSERT_EQ(0, pool.status(0));
+            ASSERT_EQ(0, pool.status(1));
+            std::atomic<int> count(0);
+            for (int i = 0; i < 1000; i++)
+                pool.post([&count] { count++; });
+            auto name = pool.enqueue([] {
+                char buf[16] = {0};
+                pthread_getname_np(pthread_self(), buf, sizeof(buf));
+                return std::string(buf);
+            });
+            std::string n = name.get();
+            ASSERT_TRUE(n == "tp-config-0" || n == "tp-other-worker") << n;
+            while (count.load() < 1000)
+                std::this_thread::yield();
+        }
+
+        //SCHED_FIFO needs privileges, the failure is reported and the pool still works
+        ThreadPool::Config rt(1);
+        rt.priority = 1;
+        ThreadPool pool(rt);
+        ASSERT_TRUE(pool.status(0) == 0 || pool.status(0) == EPERM);
+        ASSERT_EQ(7, pool.enqueue([] { return 7; }).get());
+	}
+
 }  // namespace
 
 
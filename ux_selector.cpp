@@ -1,11 +1,154 @@
 #include "ux_selector.hh"
 #include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <time.h>
 
-ux_selector::ux_selector(int PollTimeout)
+static uint64_t MonotonicNanos()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t MonotonicMicros()
+{
+	return MonotonicNanos() / 1000;
+}
+
+int StatBucket(uint64_t iNanos)
+{
+	if (iNanos < 2) return 0;
+	return std::min(63 - __builtin_clzll(iNanos), iStatBuckets - 1);
+}
+
+uint64_t StatPercentile(const uint64_t * Histogram, double dPercentile)
+{
+	uint64_t iTotal = 0, iSeen = 0;
+	for (int ii = 0; ii < iStatBuckets; ii++)
+		iTotal += Histogram[ii];
+	if (iTotal == 0) return 0;
+	for (int ii = 0; ii < iStatBuckets; ii++)
+	{
+		iSeen += Histogram[ii];
+		if (iSeen * 100.0 >= dPercentile * iTotal)
+			return (uint64_t) 2 << ii;
+	}
+	return (uint64_t) 2 << (iStatBuckets - 1);
+}
+
+void OutputRing::init(int iSize)
+{
+	uint32_t iCap = 1;
+	while ((int) iCap < iSize) iCap <<= 1;
+	sBuf = (char *) malloc(iCap);
+	//touch the memory to make sure allocation is complete
+	memset(sBuf, 0, iCap);
+	iMask = iCap - 1;
+	iHead = iTail = 0;
+}
+
+void OutputRing::release()
+{
+	free(sBuf);
+	sBuf = NULL;
+	iMask = iHead = iTail = 0;
+}
+
+void OutputRing::append(const char * Msg, int iLen)
+{
+	uint32_t iOff = iTail & iMask;
+	int iFirst = std::min(iLen, (int) (iMask + 1 - iOff));
+	memcpy(&sBuf[iOff], Msg, iFirst);
+	memcpy(sBuf, &Msg[iFirst], iLen - iFirst);
+	iTail += iLen;
+}
+
+int OutputRing::iovecs(struct iovec * iov) const
+{
+	int iLen = size();
+	if (iLen == 0) return 0;
+	uint32_t iOff = iHead & iMask;
+	int iFirst = std::min(iLen, (int) (iMask + 1 - iOff));
+	iov[0].iov_base = &sBuf[iOff];
+	iov[0].iov_len  = iFirst;
+	if (iFirst == iLen) return 1;
+	iov[1].iov_base = sBuf;
+	iov[1].iov_len  = iLen - iFirst;
+	return 2;
+}
+
+void OutputRing::consume(int iLen)
+{
+	iHead += iLen;
+	if (iHead == iTail)
+		iHead = iTail = 0;
+}
+
+void UringSource::push(uint16_t bid, int len)
+{
+	Chunk chunk = { bid, 0, len };
+	Chunks.push_back(chunk);
+}
+
+void UringSource::clear()
+{
+	for (size_t ii = 0; ii < Chunks.size(); ii++)
+		pRing->releaseBuffer(Chunks[ii].bid);
+	Chunks.clear();
+}
+
+int UringSource::iRead(char * sBuf, int iLen)
+{
+	int iCopied = 0;
+	while (iCopied < iLen && !Chunks.empty())
+	{
+		Chunk &chunk = Chunks.front();
+		int n = std::min(iLen - iCopied, chunk.len - chunk.off);
+		memcpy(&sBuf[iCopied], pRing->buffer(chunk.bid) + chunk.off, n);
+		iCopied += n;
+		chunk.off += n;
+		if (chunk.off == chunk.len)
+		{
+			pRing->releaseBuffer(chunk.bid);
+			Chunks.pop_front();
+		}
+	}
+	if (iCopied > 0) return iCopied;
+	if (iError != 0)
+	{
+		errno = iError;
+		return -1;
+	}
+	if (bEof) return 0;
+	errno = EAGAIN;
+	return -1;
+}
+
+ux_selector::ux_selector(int PollTimeout, Backend backend)
 {
     iPollTimeout = PollTimeout;
 
 	iMaxPollFD = iNextAcceptPollIdx = iNextReadPollIdx = iClientsWithDataCount = 0;
+	iReadyCount = 0;
+	iBackend = backend;
+	iEpollFD = -1;
+	pRing = NULL;
+	iRearmCount = 0;
+	iDirtyCount = iCorkBytes = iCorkMicros = iOutputBytes = 0;
+	pListener = NULL;
+	memset(&Stats, 0, sizeof(Stats));
+	iLastPollDone = 0;
+	if (iBackend == BACKEND_URING && !InitUring())
+	{
+		cout << "io_uring setup failed, using epoll" << endl;
+		iBackend = BACKEND_EPOLL;
+	}
+	if (iBackend == BACKEND_EPOLL && (iEpollFD = epoll_create1(0)) < 0)
+	{
+		cout << "epoll_create1 failed, using poll" << endl;
+		iBackend = BACKEND_POLL;
+	}
 
 	for (int client=0;client<iMaxAccept;client++)
 		iAcceptPort[client] = iAcceptSocketFD[client] = 0;
@@ -17,27 +160,68 @@ ux_selector::ux_selector(int PollTimeout)
 		Sessions[client].iMaxMsgSize = 0;
 		Sessions[client].iHeaderSize = 0;
 		Sessions[client].SkipNL = false;
-		Sessions[client].iAmountWritten = 0;
-		Sessions[client].iWriteMsgLen = 0;
 		Sessions[client].iReadAgain = 1;
+		Sessions[client].Out.sBuf = NULL;
+		Sessions[client].Out.release();
+		Sessions[client].bDirty = false;
+		Sessions[client].iDirtySince = 0;
+		Sessions[client].bWriteArmed = false;
+		Sessions[client].Source = NULL;
+		Sessions[client].iSendInFlight = 0;
+		Sessions[client].iGeneration = 0;
+		Sessions[client].bRecvArmed = false;
+		Sessions[client].iState = SESSION_CLOSED;
+		Sessions[client].iBacklogBytes = 0;
 		Connections[client].fd = -1;
+		Connections[client].revents = 0;
+		bReady[client] = false;
 	}
 }
 
 ux_selector::~ux_selector()
 {
-	for (int ii=iMaxAccept;ii<iMaxClient;ii++)
+	pListener = NULL;
+	for (int ii=iMaxAccept;ii<iMaxClient+iMaxAccept;ii++)
 		RemoveClient(ii);
+	for (int ii=0;ii<iMaxAccept;ii++)
+		if (iAcceptSocketFD[ii] > 0)
+			close(iAcceptSocketFD[ii]);
+	if (iEpollFD >= 0)
+		close(iEpollFD);
+	if (pRing != NULL)
+	{
+		//the kernel may still read from buffers of cancelled sends
+		for (int loop = 0; loop < 100 && !Orphans.empty(); loop++)
+			PollUring(10);
+		delete pRing;
+		for (size_t ii = 0; ii < Orphans.size(); ii++)
+			free(Orphans[ii].second);
+	}
+}
+
+bool ux_selector::InitUring()
+{
+	pRing = new IoUring();
+	if (pRing->init(iUringEntries, iUringBufCount, iUringBufSize) == 0)
+		return true;
+	delete pRing;
+	pRing = NULL;
+	return false;
+}
+
+uint64_t ux_selector::UringTag(int iKind, int iClient) const
+{
+	return ((uint64_t) Sessions[iClient].iGeneration << 32) | ((uint64_t) iKind << 16) | (uint64_t) iClient;
 }
 
-int ux_selector::AddServer(int iServerPort)
+int ux_selector::AddServer(int iServerPort, bool bReusePort)
 {
 	int iRC = 0, iServerSocket;
 	for (int ii = 0; ii < iMaxAccept; ii++)
 	{
 		if ( iAcceptPort[ii] <= 0 )
 		{
-			if ((iRC = InitializeAcceptSocketTCP("127.0.0.1", iServerPort, iServerSocket)) < 0)
+			if ((iRC = InitializeAcceptSocketTCP("127.0.0.1", iServerPort, iServerSocket, bReusePort)) < 0)
 			{
                 //std::cout << iRC << std::endl;
 				return iRC;
@@ -49,6 +233,16 @@ int ux_selector::AddServer(int iServerPort)
 			iAcceptSocketFD[ii] = iServerSocket;
 			Connections[ii].fd = iServerSocket;
 			Connections[ii].events = POLLRDNORM;
+			if (iBackend == BACKEND_EPOLL)
+			{
+				struct epoll_event event;
+				event.events = EPOLLIN | EPOLLET;
+				event.data.u32 = ii;
+				if (epoll_ctl(iEpollFD, EPOLL_CTL_ADD, iServerSocket, &event) < 0)
+					cout << "epoll_ctl error " << iServerSocket << endl;
+			}
+			else if (iBackend == BACKEND_URING)
+				pRing->pollMultishot(iServerSocket, UringTag(URING_ACCEPT, ii));
 			if (ii > iMaxPollFD)
 				iMaxPollFD = ii;
 			return iRC;
@@ -74,13 +268,42 @@ int ux_selector::AddClient(SocketStreamerBase *Streamer, int iMaxMsgSize, int iH
 			Sessions[ii].iMaxMsgSize 	= iMaxMsgSize;
 			Sessions[ii].iHeaderSize 	= iHeaderSize;
 			Sessions[ii].SkipNL 		= SkipNL;
-			Sessions[ii].iAmountWritten = 0;
-			Sessions[ii].iWriteMsgLen 	= 0;
-			Sessions[ii].sMsg 			= (char *) malloc(sizeof(char) * iMaxMsgSize);
-			//touch the memory to make sure allocation is complete
-			memset(Sessions[ii].sMsg, 0, iMaxMsgSize);
+			Sessions[ii].iSendInFlight 	= 0;
+			Sessions[ii].bDirty 		= false;
+			Sessions[ii].bWriteArmed 	= false;
+			Sessions[ii].iGeneration++;
+			Sessions[ii].Out.init((iOutputBytes > 0)? iOutputBytes: iMaxMsgSize * iOutputMsgs);
+			Sessions[ii].iState 		= SESSION_OK;
+			memset(&Sessions[ii].Counters, 0, sizeof(SessionCounters));
+			Streamer->SetCounters(&Sessions[ii].Counters.IO);
+			if (iBackend == BACKEND_EPOLL)
+			{
+				struct epoll_event event;
+				event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+				event.data.u32 = ii;
+				if (epoll_ctl(iEpollFD, EPOLL_CTL_ADD, iSessionFD, &event) < 0)
+				{
+					cout << "epoll_ctl error " << iSessionFD << endl;
+					Sessions[ii].Out.release();
+					Sessions[ii].Streamer = NULL;
+					Connections[ii].fd = -1;
+					return -1;
+				}
+				//data that arrived before registration does not raise an edge
+				bReady[ii] = true;
+				iReadyList[iReadyCount++] = ii;
+			}
+			else if (iBackend == BACKEND_URING)
+			{
+				Sessions[ii].Source = new UringSource(pRing);
+				Streamer->SetSource(Sessions[ii].Source);
+				Sessions[ii].bRecvArmed = (pRing->recvMultishot(iSessionFD, UringTag(URING_RECV, ii)) == 0);
+				if (!Sessions[ii].bRecvArmed)
+					iRearmList[iRearmCount++] = ii;
+			}
 			if (ii > iMaxPollFD)
 				iMaxPollFD = ii;
+			setBackpressure(ii, DefaultBackpressure);
 			return ii;
 		}
 	}
@@ -91,33 +314,128 @@ void ux_selector::RemoveClient(int client)
 {
 	if ( client < iMaxAccept || client > iMaxPollFD || Connections[client].fd == -1 ) return;
 
+	if (iBackend == BACKEND_EPOLL)
+		epoll_ctl(iEpollFD, EPOLL_CTL_DEL, Connections[client].fd, NULL);
+	for (int ii = 0; bReady[client] && ii < iReadyCount; ii++)
+		if (iReadyList[ii] == client)
+			RemoveReady(ii);
+	for (int ii = 0; Sessions[client].bDirty && ii < iDirtyCount; ii++)
+		if (iDirtyList[ii] == client)
+			iDirtyList[ii] = iDirtyList[--iDirtyCount];
+	Sessions[client].bDirty = false;
+	Sessions[client].bWriteArmed = false;
+	if (iBackend == BACKEND_URING)
+	{
+		//completions of the old requests are told apart by the generation in their tag,
+		//which the next AddClient of the slot bumps
+		pRing->cancel(UringTag(URING_RECV, client));
+		if (Sessions[client].iSendInFlight > 0)
+		{
+			pRing->cancel(UringTag(URING_SEND, client));
+			Orphans.push_back(make_pair(UringTag(URING_SEND, client), Sessions[client].Out.sBuf));
+			Sessions[client].Out.sBuf = NULL;
+		}
+		pRing->submit(0);
+		for (int ii = 0; ii < iRearmCount; ii++)
+			if (iRearmList[ii] == client)
+				iRearmList[ii--] = iRearmList[--iRearmCount];
+		Sessions[client].Streamer->SetSource(NULL);
+		delete Sessions[client].Source;
+		Sessions[client].Source         = NULL;
+		Sessions[client].iSendInFlight  = 0;
+		Sessions[client].bRecvArmed     = false;
+	}
 	disconnectTCP(Connections[client].fd);
 	delete Sessions[client].Streamer;
-	free (Sessions[client].sMsg);
+	Sessions[client].Out.release();
+	Sessions[client].Backlog.clear();
+	Sessions[client].iBacklogBytes = 0;
 
 	Sessions[client].iReadAttempts 	= 0;
 	Sessions[client].iMaxMsgSize   	= 0;
 	Sessions[client].iHeaderSize 	= 0;
 	Sessions[client].SkipNL 		= false;
-	Sessions[client].iAmountWritten = 0;
-	Sessions[client].iWriteMsgLen 	= 0;
 	Sessions[client].iReadAgain 	= 1;
 	Sessions[client].SkipNL 		= false;
 	Sessions[client].Streamer       = NULL;
 	Connections[client].fd 			= -1;
+	SetState(client, SESSION_CLOSED);
 }
 
 int ux_selector::PollForSocketEvent()
+{
+	uint64_t iStart = MonotonicNanos();
+	if (iLastPollDone > 0)
+		StatAdd(Stats.iLoopNanos[StatBucket(iStart - iLastPollDone)]);
+	int iRC = WaitForEvents();
+	iLastPollDone = MonotonicNanos();
+	StatAdd(Stats.iPollNanos[StatBucket(iLastPollDone - iStart)]);
+	StatAdd(Stats.iPolls);
+	if (iRC > 0)
+	{
+		StatAdd(Stats.iWakeups);
+		StatAdd(Stats.iEvents, iRC);
+	}
+	return iRC;
+}
+
+int ux_selector::WaitForEvents()
 {
 	int iRC=0;
 
+	//corked output that is due goes out first, the rest bounds how long we may block.
+	//Output the socket did not take is flushed on write readiness and does not.
+	FlushDirty(false);
+	int iWait = iPollTimeout;
+	if (iDirtyCount > 0)
+	{
+		int iBudget = std::max(1, (iCorkMicros + 999) / 1000);
+		if (iWait < 0 || iWait > iBudget) iWait = iBudget;
+	}
+
+	if (iBackend != BACKEND_POLL)
+	{
+		//do not block while sessions or listeners are not drained yet
+		int iTimeout = iWait;
+		for (int ii = 0; ii < iMaxAccept && iTimeout != 0; ii++)
+			if (Connections[ii].revents & POLLRDNORM) iTimeout = 0;
+		if (iReadyCount > 0 || iClientsWithDataCount > 0) iTimeout = 0;
+
+		if (iBackend == BACKEND_URING)
+			iRC = PollUring(iTimeout);
+		else
+		{
+			while ((iRC = epoll_wait(iEpollFD, Events, iMaxClient+iMaxAccept, iTimeout)) < 0)
+			{
+				if (errno != EINTR) sleep(1);
+			}
+			for (int ii = 0; ii < iRC; ii++)
+			{
+				int idx = Events[ii].data.u32;
+				if (idx < iMaxAccept)
+					Connections[idx].revents = POLLRDNORM;
+				else if (Connections[idx].fd != -1)
+				{
+					if (Events[ii].events & ~EPOLLOUT)
+						AddReady(idx);
+					if (Events[ii].events & EPOLLOUT)
+						Writable(idx);
+				}
+			}
+		}
+		iNextAcceptPollIdx = 0;
+		iClientsWithDataCount = 0;
+		iNextReadPollIdx = 0;
+		return iRC;
+	}
+
 	while (true)
 	{
 		if (iClientsWithDataCount == 0)
 		{
-			if ((iRC = poll(Connections, iMaxPollFD + 1, iPollTimeout)) < 0)
+			if ((iRC = poll(Connections, iMaxPollFD + 1, iWait)) < 0)
 			{
-                sleep(1);
+				if (errno != EINTR) sleep(1);
 				continue;
 			}
 		}
@@ -125,12 +443,15 @@ int ux_selector::PollForSocketEvent()
 		{
 			if ((iRC = poll(Connections, iMaxPollFD + 1, 0)) < 0)
 			{
-                sleep(1);
+				if (errno != EINTR) sleep(1);
 				continue;
 			}
 		}
 		break;
 	}
+	for (int ii = iMaxAccept; iRC > 0 && ii < iMaxPollFD+1; ii++)
+		if (Connections[ii].fd != -1 && (Connections[ii].revents & POLLOUT))
+			Writable(ii);
 	iNextAcceptPollIdx = 0;
 	iClientsWithDataCount = 0;
 	iNextReadPollIdx = iMaxAccept;
@@ -138,56 +459,352 @@ int ux_selector::PollForSocketEvent()
     return iRC;
 }
 
-int ux_selector::Read(int &iClientID, char * Msg)
+void ux_selector::RemoveReady(int iPos)
 {
-	int iRC;
-	iClientID = -1;
-	for (int ii = iNextReadPollIdx; ii < iMaxPollFD+1; ii++)
+	bReady[iReadyList[iPos]] = false;
+	iReadyList[iPos] = iReadyList[--iReadyCount];
+}
+
+void ux_selector::AddReady(int iClient)
+{
+	if (bReady[iClient]) return;
+	bReady[iClient] = true;
+	iReadyList[iReadyCount++] = iClient;
+}
+
+//One io_uring_enter per pass: submits the queued sends and receive re-arms, waits for
+//completions upto the timeout and turns them into ready sessions
+int ux_selector::PollUring(int iTimeout)
+{
+	int iKept = 0;
+	for (int ii = 0; ii < iRearmCount; ii++)
 	{
-		iNextReadPollIdx++;
+		int client = iRearmList[ii];
+		if (pRing->recvMultishot(Connections[client].fd, UringTag(URING_RECV, client)) == 0)
+			Sessions[client].bRecvArmed = true;
+		else
+			iRearmList[iKept++] = client;
+	}
+	iRearmCount = iKept;
 
-		if (Connections[ii].fd == -1) continue;
+	if (pRing->submit(iTimeout) < 0)
+		cout << "io_uring_enter error " << errno << endl;
 
-		if (Connections[ii].revents & (POLLRDNORM | POLLERR) /*|| Sessions[ii].iReadAgain > 0*/)
+	int iEvents = 0;
+	unsigned count;
+	while ((count = pRing->reap(Completions, iUringEntries)) > 0)
+	{
+		for (unsigned ii = 0; ii < count; ii++)
 		{
-			iClientID = ii;
-			memset(Msg, '\0', Sessions[ii].iMaxMsgSize);
-			if ((iRC = Sessions[ii].Streamer->iReadNonBlockingN(Msg, Sessions[ii].iMaxMsgSize, Sessions[ii].iHeaderSize, Sessions[ii].SkipNL)) < 0)
+			const IoCompletion &cqe = Completions[ii];
+			if (cqe.user_data == 0) continue; //cancel results
+
+			int kind = (int) ((cqe.user_data >> 16) & 0xffff);
+			int client = (int) (cqe.user_data & 0xffff);
+			bool bStale = (unsigned) (cqe.user_data >> 32) != Sessions[client].iGeneration || Connections[client].fd == -1;
+			SocketSession &session = Sessions[client];
+
+			if (kind == URING_RECV)
 			{
-				if ( iRC != SocketStreamerBase::ERROR_EAGAIN || Sessions[ii].iReadAttempts++ >= iMaxReadAttempts )
+				if (bStale)
 				{
-					cout << "Read error : " << iRC << " Attempts: " << Sessions[ii].iReadAttempts << endl;
-					RemoveClient(iClientID);
-					return DISCONNECT;
+					if (IoUring::hasBuffer(cqe.flags)) pRing->releaseBuffer(IoUring::bufferId(cqe.flags));
+					continue;
 				}
+				if (cqe.res > 0 && IoUring::hasBuffer(cqe.flags))
+					session.Source->push(IoUring::bufferId(cqe.flags), cqe.res);
+				else if (cqe.res == 0)
+					session.Source->bEof = true;
+				else if (cqe.res != -ENOBUFS && cqe.res != -EAGAIN)
+					session.Source->iError = -cqe.res;
 
-				return FAILURE;
+				//multishot ends on errors and when the buffer ring runs dry
+				if (!IoUring::hasMore(cqe.flags))
+				{
+					session.bRecvArmed = false;
+					if (!session.Source->bEof && session.Source->iError == 0)
+						iRearmList[iRearmCount++] = client;
+				}
+				if (cqe.res != -ENOBUFS && cqe.res != -EAGAIN)
+				{
+					AddReady(client);
+					iEvents++;
+				}
 			}
-			else
+			else if (kind == URING_SEND)
 			{
-				++iClientsWithDataCount;
-				Sessions[ii].iReadAttempts = 0;
-				//Sessions[ii].iReadAgain = 1;
-				return SUCCESS;
+				if (bStale)
+				{
+					for (size_t jj = 0; jj < Orphans.size(); jj++)
+					{
+						if (Orphans[jj].first != cqe.user_data) continue;
+						free(Orphans[jj].second);
+						Orphans.erase(Orphans.begin() + jj);
+						break;
+					}
+					continue;
+				}
+				int iSent = session.iSendInFlight;
+				session.iSendInFlight = 0;
+				if (cqe.res < 0 && cqe.res != -EAGAIN)
+				{
+					cout << "iRC :" << cqe.res << endl;
+					RemoveClient(client);
+					continue;
+				}
+				if (cqe.res == -EAGAIN)
+					StatAdd(session.Counters.IO.iWriteEagain);
+				if (cqe.res > 0)
+				{
+					if (cqe.res < iSent)
+						StatAdd(session.Counters.IO.iPartialWrites);
+					session.Out.consume(cqe.res);
+					StatAdd(session.Counters.IO.iBytesOut, cqe.res);
+					TrackDepth(client);
+				}
+				if (session.iState == SESSION_CONGESTED)
+					Refill(client);
+				//short send, the rest goes with whatever was appended meanwhile
+				QueueSend(client);
+			}
+			else if (kind == URING_ACCEPT && !bStale)
+			{
+				Connections[client].revents = POLLRDNORM;
+				if (!IoUring::hasMore(cqe.flags))
+					pRing->pollMultishot(Connections[client].fd, UringTag(URING_ACCEPT, client));
+				iEvents++;
 			}
 		}
 	}
+	return iEvents;
+}
 
-	//Read for more unread msgs in socketstreamer
-	for (int ii = iMaxAccept; ii < iMaxPollFD+1; ii++)
+void ux_selector::QueueSend(int iClientID)
+{
+	SocketSession &session = Sessions[iClientID];
+	if (session.iSendInFlight > 0) return;
+
+	//appends keep going into the free part of the ring while this is in flight,
+	//a wrapped region goes in two sends
+	struct iovec iov[2];
+	if (session.Out.iovecs(iov) == 0) return;
+	if (pRing->send(Connections[iClientID].fd, iov[0].iov_base, iov[0].iov_len, UringTag(URING_SEND, iClientID)) == 0)
 	{
-		if (Connections[ii].fd == -1) continue;
-		if (Connections[ii].revents & (POLLRDNORM | POLLERR) &&
-                Sessions[ii].Streamer->hasUnreadMsg(Sessions[ii].iHeaderSize))
+		session.iSendInFlight = (int) iov[0].iov_len;
+		StatAdd(session.Counters.IO.iWriteCalls);
+	}
+}
+
+//One sweep over the ready list per poll. A session leaves the list once its socket is
+//drained (EAGAIN without a complete message), the edge trigger (or the next io_uring
+//receive completion) brings it back.
+int ux_selector::ReadEpoll(int &iClientID, char * Msg, const char ** pView, int * pLen)
+{
+	int iRC;
+	while (iNextReadPollIdx < iReadyCount)
+	{
+		int ii = iReadyList[iNextReadPollIdx];
+		iClientID = ii;
+		if ((iRC = ReadSession(ii, Msg, pView, pLen)) < 0)
 		{
-			iNextReadPollIdx = ii;
-			return Read(iClientID, Msg);
+			if ( iRC == SocketStreamerBase::ERROR_EAGAIN )
+			{
+				RemoveReady(iNextReadPollIdx);
+				continue;
+			}
+			cout << "Read error : " << iRC << endl;
+			RemoveClient(iClientID);
+			return DISCONNECT;
 		}
+		++iClientsWithDataCount;
+		++iNextReadPollIdx;
+		return SUCCESS;
 	}
-
+	iClientID = -1;
 	return END_OF_SOCK_LIST;
 }
 
+//Reads one msg of the session, copied into Msg or as a view of the streamer buffer
+int ux_selector::ReadSession(int iClient, char * Msg, const char ** pView, int * pLen)
+{
+	int iRC;
+	SocketSession &session = Sessions[iClient];
+	if (pView != NULL)
+		iRC = session.Streamer->iReadView(*pView, session.iMaxMsgSize, session.iHeaderSize, session.SkipNL);
+	else if ((iRC = session.Streamer->iReadNonBlockingN(Msg, session.iMaxMsgSize, session.iHeaderSize, session.SkipNL)) >= 0 &&
+			iRC < session.iMaxMsgSize)
+		Msg[iRC] = '\0'; //terminate rather than clear the whole buffer
+	if (iRC >= 0)
+		StatAdd(session.Counters.iMsgsIn);
+	if (iRC >= 0 && pLen != NULL)
+		*pLen = iRC;
+	return iRC;
+}
+
+int ux_selector::Read(int &iClientID, char * Msg)
+{
+	return ReadNext(iClientID, Msg, NULL, NULL);
+}
+
+int ux_selector::ReadView(int &iClientID, const char *& pMsg, int &iMsgLen)
+{
+	pMsg = NULL;
+	iMsgLen = 0;
+	return ReadNext(iClientID, NULL, &pMsg, &iMsgLen);
+}
+
+void ux_selector::Release(int iClientID)
+{
+	if ( iClientID < iMaxAccept || iClientID > iMaxPollFD || Connections[iClientID].fd == -1 ) return;
+	Sessions[iClientID].Streamer->ReleaseView();
+}
+
+int ux_selector::ReadNext(int &iClientID, char * Msg, const char ** pView, int * pLen)
+{
+	int iRC;
+	iClientID = -1;
+	if (iBackend != BACKEND_POLL)
+		return ReadEpoll(iClientID, Msg, pView, pLen);
+	while (true)
+	{
+		for (int ii = iNextReadPollIdx; ii < iMaxPollFD+1; ii++)
+		{
+			iNextReadPollIdx++;
+
+			if (Connections[ii].fd == -1) continue;
+
+			if (Connections[ii].revents & (POLLRDNORM | POLLERR) /*|| Sessions[ii].iReadAgain > 0*/)
+			{
+				iClientID = ii;
+				if ((iRC = ReadSession(ii, Msg, pView, pLen)) < 0)
+				{
+					if ( iRC != SocketStreamerBase::ERROR_EAGAIN || Sessions[ii].iReadAttempts++ >= iMaxReadAttempts )
+					{
+						cout << "Read error : " << iRC << " Attempts: " << Sessions[ii].iReadAttempts << endl;
+						RemoveClient(iClientID);
+						return DISCONNECT;
+					}
+
+					return FAILURE;
+				}
+				else
+				{
+					++iClientsWithDataCount;
+					Sessions[ii].iReadAttempts = 0;
+					//stay on this session while it has buffered msgs
+					if (Sessions[ii].Streamer->hasUnreadMsg(Sessions[ii].iHeaderSize))
+						iNextReadPollIdx = ii;
+					return SUCCESS;
+				}
+			}
+		}
+
+		//Read for more unread msgs in socketstreamer
+		int iUnread = -1;
+		for (int ii = iMaxAccept; ii < iMaxPollFD+1 && iUnread < 0; ii++)
+		{
+			if (Connections[ii].fd == -1) continue;
+			if (Connections[ii].revents & (POLLRDNORM | POLLERR) &&
+	                Sessions[ii].Streamer->hasUnreadMsg(Sessions[ii].iHeaderSize))
+				iUnread = ii;
+		}
+		if (iUnread < 0)
+			return END_OF_SOCK_LIST;
+		iNextReadPollIdx = iUnread;
+	}
+}
+
+//Hands out the complete msgs buffered or readable for the session, upto iMaxMsgs.
+//bDrained is set once the socket had nothing more (EAGAIN). Returns the msg count,
+//or the read error when the session failed before delivering anything.
+int ux_selector::DrainSession(int iClient, std::vector<SocketMsgView> & Msgs, int iMaxMsgs, bool & bDrained)
+{
+	SocketSession &session = Sessions[iClient];
+	SocketMsgView view;
+	int iCount = 0, iRC = 0;
+	view.iClientID = iClient;
+	while (iMaxMsgs <= 0 || iCount < iMaxMsgs)
+	{
+		if ((iRC = session.Streamer->iReadView(view.pMsg, session.iMaxMsgSize, session.iHeaderSize, session.SkipNL, true)) < 0)
+			break;
+		view.iMsgLen = iRC;
+		Msgs.push_back(view);
+		iCount++;
+	}
+	bDrained = (iRC == SocketStreamerBase::ERROR_EAGAIN);
+	if (iCount > 0)
+	{
+		HeldSessions.push_back(iClient);
+		StatAdd(session.Counters.iMsgsIn, iCount);
+	}
+	//a failing session is removed on the next pass, after its views were used
+	return (iCount > 0 || iRC >= 0 || bDrained)? iCount: iRC;
+}
+
+int ux_selector::ReadBatch(std::vector<SocketMsgView> & Msgs, int iMaxPerSession)
+{
+	int iRC;
+	bool bDrained;
+	SocketMsgView closed;
+	closed.pMsg = NULL;
+	closed.iMsgLen = DISCONNECT;
+	Msgs.clear();
+
+	for (size_t ii = 0; ii < HeldSessions.size(); ii++)
+		if (Connections[HeldSessions[ii]].fd != -1)
+			Sessions[HeldSessions[ii]].Streamer->ReleaseView();
+	HeldSessions.clear();
+
+	if (iBackend != BACKEND_POLL)
+	{
+		//each ready session once, drained sessions leave the ready list
+		for (int pos = 0; pos < iReadyCount; )
+		{
+			int client = iReadyList[pos];
+			if ((iRC = DrainSession(client, Msgs, iMaxPerSession, bDrained)) < 0)
+			{
+				cout << "Read error : " << iRC << endl;
+				RemoveClient(client);
+				closed.iClientID = client;
+				Msgs.push_back(closed);
+				continue;
+			}
+			if (iRC > 0)
+				++iClientsWithDataCount;
+			if (bDrained)
+				RemoveReady(pos);
+			else
+				pos++;
+		}
+		iNextReadPollIdx = iReadyCount;
+		return (int) Msgs.size();
+	}
+
+	for (int client = iMaxAccept; client < iMaxPollFD+1; client++)
+	{
+		if (Connections[client].fd == -1) continue;
+		if (!(Connections[client].revents & (POLLRDNORM | POLLERR)) &&
+				!Sessions[client].Streamer->hasUnreadMsg(Sessions[client].iHeaderSize))
+			continue;
+
+		iRC = DrainSession(client, Msgs, iMaxPerSession, bDrained);
+		if (iRC < 0 || (iRC == 0 && Sessions[client].iReadAttempts++ >= iMaxReadAttempts))
+		{
+			cout << "Read error : " << iRC << " Attempts: " << Sessions[client].iReadAttempts << endl;
+			RemoveClient(client);
+			closed.iClientID = client;
+			Msgs.push_back(closed);
+		}
+		else if (iRC > 0)
+		{
+			++iClientsWithDataCount;
+			Sessions[client].iReadAttempts = 0;
+		}
+	}
+	iNextReadPollIdx = iMaxPollFD+1;
+	return (int) Msgs.size();
+}
+
 int ux_selector::Accept(int &iServerPort, int &iClientFD)
 {
 	int iRC, iNewSocket;
@@ -195,12 +812,18 @@ int ux_selector::Accept(int &iServerPort, int &iClientFD)
 	iServerPort = iClientFD = -1;
 	for (int i = iNextAcceptPollIdx; i < iMaxAccept; i++)
 	{
-		iNextAcceptPollIdx++;
+		//edge triggered listeners are accepted from until drained
+		if (iBackend == BACKEND_POLL) iNextAcceptPollIdx++;
 		if (iAcceptSocketFD[i] > 0 && Connections[i].revents & POLLRDNORM)
 		{
 			iServerPort = iAcceptPort[i];
 			if ((iRC = acceptConnectionTCP(iAcceptSocketFD[i], iNewSocket, client)) < 0)
 			{
+				if (iBackend != BACKEND_POLL)
+				{
+					Connections[i].revents = 0;
+					iNextAcceptPollIdx = i + 1;
+				}
 				if (iRC == ACCEPT_TCP_UTILS_ERROR)
 					return WOULD_BLOCK;
 			}
@@ -255,14 +878,9 @@ void ux_selector::ConfigureSocketOptions( int iSockFD )
 
 void ux_selector::flush()
 {
-	for (int ii = iMaxAccept; ii < iMaxPollFD+1; ii++)
-	{
-		if (Connections[ii].fd == -1) continue;
-		if ( Sessions[ii].iWriteMsgLen - Sessions[ii].iAmountWritten > 0 )
-		{
-			WriteInternal(ii);
-		}
-	}
+	FlushDirty(true);
+	if (iBackend == BACKEND_URING)
+		pRing->submit(0);
 }
 
 int ux_selector::Publish(int iClientID, char * Msg, int MsgLen)
@@ -273,63 +891,268 @@ int ux_selector::Publish(int iClientID, char * Msg, int MsgLen)
     return iRC;
 }
 
+int ux_selector::PublishBatch(int iClientID, const struct iovec * Msgs, int iCount)
+{
+    if ( iClientID < iMaxAccept || iClientID > iMaxPollFD || Connections[iClientID].fd == -1 ) return  END_OF_SOCK_LIST;
+    return Sessions[iClientID].Streamer->iPublishBatch(Msgs, iCount);
+}
+
 int ux_selector::Write(int iClientID, char * Msg, int MsgLen)
 {
-	int iRC = 0;
 	if ( iClientID < iMaxAccept || iClientID > iMaxPollFD || Connections[iClientID].fd == -1 ) return  END_OF_SOCK_LIST;
+	SocketSession &session = Sessions[iClientID];
+	if ( MsgLen > session.Out.capacity() ) return FAILURE;
 
-	//Flush partial messages
-	if ( Sessions[iClientID].iAmountWritten > 0 )
+	//Over the high watermark. Push out what is pending before the policy kicks in.
+	if ( !Admit(iClientID, MsgLen) )
 	{
-		iRC = WriteInternal(iClientID);
-		if (iRC != SUCCESS)
-		{
-			RemoveClient(iClientID);
+		if (FlushSession(iClientID) == DISCONNECT)
 			return DISCONNECT;
-		}
+		if ( !Admit(iClientID, MsgLen) )
+			return Congested(iClientID, Msg, MsgLen);
+	}
+
+	session.Out.append(Msg, MsgLen);
+	StatAdd(session.Counters.iMsgsOut);
+	TrackDepth(iClientID);
+
+	//the socket is full, its write readiness flushes the ring
+	if ( session.bWriteArmed )
+		return SUCCESS;
+
+	//Corked until enough is pending or the next poll finds it due
+	if ( session.Out.size() < iCorkBytes )
+	{
+		MarkDirty(iClientID);
+		return SUCCESS;
+	}
+	if (FlushSession(iClientID) == DISCONNECT)
+		return DISCONNECT;
+	if (AwaitOutput(iClientID))
+		MarkDirty(iClientID);
+	return SUCCESS;
+}
+
+//Msgs go straight to the ring while nothing is parked and the session is under its high watermark
+bool ux_selector::Admit(int iClientID, int MsgLen) const
+{
+	const SocketSession &session = Sessions[iClientID];
+	return session.Backlog.empty() && session.Out.space() >= MsgLen &&
+		session.Out.size() + MsgLen <= session.iHighWatermark;
+}
+
+//Applies the slow consumer policy to a msg the session cannot take now
+int ux_selector::Congested(int iClientID, char * Msg, int MsgLen)
+{
+	SocketSession &session = Sessions[iClientID];
+	SetState(iClientID, SESSION_CONGESTED);
+	if (session.iPolicy == POLICY_DISCONNECT)
+	{
+		cout << "Slow consumer disconnected " << iClientID << " pending " << session.Out.size() << endl;
+		RemoveClient(iClientID);
+		return DISCONNECT;
+	}
+	MarkDirty(iClientID);
+	if (session.iPolicy == POLICY_BLOCK)
+	{
+		StatAdd(session.Counters.iWouldBlock);
+		return WOULD_BLOCK;
 	}
 
-	//No parial messages. But there may be buffered messages.
-	//Flush if buffer size exceeded.
-	if ( Sessions[iClientID].iWriteMsgLen + MsgLen > WRITE_BUFF_SIZE )
+	uint64_t iKey = (session.iPolicy == POLICY_CONFLATE && pListener != NULL)?
+		pListener->conflateKey(iClientID, Msg, MsgLen): 0;
+	if (iKey != 0)
 	{
-		if ( Sessions[iClientID].iWriteMsgLen > 0 )
+		for (std::deque<std::pair<uint64_t, std::string> >::iterator it = session.Backlog.begin(); it != session.Backlog.end(); ++it)
 		{
-			iRC = WriteInternal(iClientID);
-			if (iRC != SUCCESS)
-			{
-				RemoveClient(iClientID);
-				return DISCONNECT;
-			}
+			if (it->first != iKey) continue;
+			session.iBacklogBytes += MsgLen - (int) it->second.size();
+			it->second.assign(Msg, MsgLen);
+			StatAdd(session.Counters.iConflated);
+			return SUCCESS;
 		}
 	}
+	session.Backlog.push_back(make_pair(iKey, std::string(Msg, MsgLen)));
+	session.iBacklogBytes += MsgLen;
+	StatAdd(session.Counters.iQueued);
+	while (session.iBacklogBytes > session.iMaxBacklog)
+	{
+		session.iBacklogBytes -= (int) session.Backlog.front().second.size();
+		session.Backlog.pop_front();
+		StatAdd(session.Counters.iDropped);
+	}
+	TrackDepth(iClientID);
+	return SUCCESS;
+}
+
+//Moves parked msgs into the ring as it drains, the session recovers at the low watermark
+void ux_selector::Refill(int iClientID)
+{
+	SocketSession &session = Sessions[iClientID];
+	//kept under the high watermark so late msgs can still conflate in the backlog
+	while (!session.Backlog.empty() && session.Out.size() + (int) session.Backlog.front().second.size() <= session.iHighWatermark)
+	{
+		const std::string &msg = session.Backlog.front().second;
+		session.Out.append(msg.data(), (int) msg.size());
+		session.iBacklogBytes -= (int) msg.size();
+		StatAdd(session.Counters.iMsgsOut);
+		session.Backlog.pop_front();
+	}
+	TrackDepth(iClientID);
+	if (session.Backlog.empty() && session.Out.size() <= session.iLowWatermark)
+		SetState(iClientID, SESSION_OK);
+}
 
-	memcpy( &Sessions[iClientID].sMsg[Sessions[iClientID].iWriteMsgLen], Msg, MsgLen);
-	Sessions[iClientID].iWriteMsgLen += MsgLen;
+void ux_selector::SetState(int iClientID, int iState)
+{
+	int iOldState = Sessions[iClientID].iState;
+	if (iOldState == iState) return;
+	Sessions[iClientID].iState = iState;
+	if (iState == SESSION_CONGESTED)
+		StatAdd(Sessions[iClientID].Counters.iCongested);
+	if (pListener != NULL)
+		pListener->onSessionState(iClientID, iOldState, iState);
+}
+
+int ux_selector::setBackpressure(int iClientID, const Backpressure & config)
+{
+	if ( iClientID < iMaxAccept || iClientID > iMaxPollFD || Connections[iClientID].fd == -1 ) return  END_OF_SOCK_LIST;
+	SocketSession &session = Sessions[iClientID];
+	int iCapacity = session.Out.capacity();
+	session.iPolicy 		= config.ePolicy;
+	session.iHighWatermark 	= (config.iHighWatermark > 0)? std::min(config.iHighWatermark, iCapacity): iCapacity;
+	session.iLowWatermark 	= (config.iLowWatermark > 0)? std::min(config.iLowWatermark, session.iHighWatermark): session.iHighWatermark / 2;
+	session.iMaxBacklog 	= (config.iMaxBacklog > 0)? config.iMaxBacklog: iCapacity;
+	return SUCCESS;
+}
 
-	//Flush new message by itself if bigger than the buffer.
-	if ( Sessions[iClientID].iWriteMsgLen > WRITE_BUFF_SIZE )
+int ux_selector::getStats(int iClientID, SessionCounters & Snapshot) const
+{
+	if ( iClientID < iMaxAccept || iClientID > iMaxPollFD || Connections[iClientID].fd == -1 ) return END_OF_SOCK_LIST;
+	StatSnapshot(Sessions[iClientID].Counters, Snapshot);
+	return SUCCESS;
+}
+
+void ux_selector::TrackDepth(int iClientID)
+{
+	SocketSession &session = Sessions[iClientID];
+	uint64_t iPending = session.Out.size() + session.iBacklogBytes;
+	StatSet(session.Counters.iQueueDepth, iPending);
+	if (iPending > session.Counters.iMaxPending)
+		StatSet(session.Counters.iMaxPending, iPending);
+}
+
+unsigned ux_selector::getGeneration(int iClientID) const
+{
+	if ( iClientID < iMaxAccept || iClientID >= iMaxClient+iMaxAccept ) return 0;
+	return Sessions[iClientID].iGeneration;
+}
+
+int ux_selector::getState(int iClientID) const
+{
+	if ( iClientID < iMaxAccept || iClientID > iMaxPollFD || Connections[iClientID].fd == -1 ) return SESSION_CLOSED;
+	return Sessions[iClientID].iState;
+}
+
+void ux_selector::MarkDirty(int iClientID)
+{
+	if (Sessions[iClientID].bDirty) return;
+	Sessions[iClientID].bDirty = true;
+	Sessions[iClientID].iDirtySince = (iCorkMicros > 0)? MonotonicMicros(): 0;
+	iDirtyList[iDirtyCount++] = iClientID;
+}
+
+//Flushes the dirty sessions whose cork budget ran out (all of them with bAll).
+//Sessions the socket did not fully take wait for write readiness.
+void ux_selector::FlushDirty(bool bAll)
+{
+	if (iDirtyCount == 0) return;
+	uint64_t iNow = (bAll || iCorkMicros == 0)? 0: MonotonicMicros();
+	for (int ii = 0; ii < iDirtyCount; )
 	{
-		iRC = WriteInternal(iClientID);
-		if (iRC != SUCCESS)
+		int client = iDirtyList[ii];
+		if (iNow > 0 && iNow - Sessions[client].iDirtySince < (uint64_t) iCorkMicros)
 		{
-			RemoveClient(iClientID);
-			return DISCONNECT;
+			ii++;
+			continue;
 		}
+		//a disconnect takes the session off the list
+		if (FlushSession(client) == DISCONNECT)
+			continue;
+		if (AwaitOutput(client))
+		{
+			ii++;
+			continue;
+		}
+		Sessions[client].bDirty = false;
+		iDirtyList[ii] = iDirtyList[--iDirtyCount];
 	}
+}
 
-	return SUCCESS;
+//Output left after a flush. The socket tells when it takes more (write interest, or the
+//send completion with io_uring), only a send io_uring could not queue is retried on the
+//next poll. Returns true when the session has to stay dirty.
+bool ux_selector::AwaitOutput(int iClientID)
+{
+	SocketSession &session = Sessions[iClientID];
+	bool bPending = session.Out.size() > 0 || !session.Backlog.empty();
+	if (iBackend == BACKEND_URING)
+		return bPending && session.iSendInFlight == 0;
+	if (bPending != session.bWriteArmed)
+		SetWriteInterest(iClientID, bPending);
+	return false;
+}
+
+void ux_selector::SetWriteInterest(int iClientID, bool bArm)
+{
+	Sessions[iClientID].bWriteArmed = bArm;
+	Connections[iClientID].events = (bArm)? (POLLRDNORM | POLLOUT): POLLRDNORM;
+	if (iBackend == BACKEND_EPOLL)
+	{
+		//re-arming reports the current readiness again, edges are not lost
+		struct epoll_event event;
+		event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | ((bArm)? (uint32_t) EPOLLOUT: 0u);
+		event.data.u32 = iClientID;
+		if (epoll_ctl(iEpollFD, EPOLL_CTL_MOD, Connections[iClientID].fd, &event) < 0)
+			cout << "epoll_ctl error " << Connections[iClientID].fd << endl;
+	}
 }
 
+void ux_selector::Writable(int iClientID)
+{
+	if (!Sessions[iClientID].bWriteArmed) return;
+	if (FlushSession(iClientID) != DISCONNECT)
+		AwaitOutput(iClientID);
+}
+
+int ux_selector::FlushSession(int iClientID)
+{
+	if (iBackend == BACKEND_URING)
+	{
+		QueueSend(iClientID);
+		return SUCCESS;
+	}
+	//an edge only comes once the socket fills up, so a refilled ring goes out right away
+	int iRC;
+	do
+	{
+		iRC = WriteInternal(iClientID);
+		if (iRC == DISCONNECT || Sessions[iClientID].iState != SESSION_CONGESTED)
+			break;
+		Refill(iClientID);
+	} while (iRC == SUCCESS && Sessions[iClientID].Out.size() > 0);
+	return iRC;
+}
+
+//One writev per attempt for everything in the output ring
 int ux_selector::WriteInternal(int iClientID)
 {
-	int iWriteAttempts = 0, iAmountWritten = 0, iRC = 0;
-	while (1)
+	int iWriteAttempts = 0, iRC = 0;
+	struct iovec iov[2];
+	OutputRing &out = Sessions[iClientID].Out;
+	while (out.size() > 0)
 	{
-		iRC = Sessions[iClientID].Streamer->iWriteNonBlockingN(
-			&Sessions[iClientID].sMsg[Sessions[iClientID].iAmountWritten],
-			Sessions[iClientID].iWriteMsgLen - Sessions[iClientID].iAmountWritten,
-			iAmountWritten);
+		iRC = Sessions[iClientID].Streamer->iWritevNonBlocking(iov, out.iovecs(iov));
 
 		if (iRC < 0)
 		{
@@ -339,20 +1162,15 @@ int ux_selector::WriteInternal(int iClientID)
 				RemoveClient(iClientID);
 				return DISCONNECT;
 			}
-			else
-			{
-				//cout << "iWriteAttempts :" << iWriteAttempts << endl;
-				Sessions[iClientID].iAmountWritten += iAmountWritten;
-				if ( ++iWriteAttempts >= iMaxWriteAttepts )
-					return WOULD_BLOCK;
-			}
+			//cout << "iWriteAttempts :" << iWriteAttempts << endl;
+			if ( ++iWriteAttempts >= iMaxWriteAttepts )
+				return WOULD_BLOCK;
 		}
 		else
 		{
-			Sessions[iClientID].iWriteMsgLen   = 0;
-			Sessions[iClientID].iAmountWritten = 0;
-			return SUCCESS;
+			out.consume(iRC);
+			TrackDepth(iClientID);
 		}
 	}
+	return SUCCESS;
 }
-
@@ -3,16 +3,104 @@
 
 #include "TcpUtils.hpp"
 #include "SocketStreamerBase.hh"
+#include "IoUring.hpp"
 #include <stdio.h>
 #include <stdlib.h>
 #include <iostream>
 #include <netinet/tcp.h>
 #include <ctype.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 #include <cstring>
 #include <string>
+#include <deque>
+#include <vector>
 using namespace std;
 
+//Bytes received by io_uring for one session, in provided buffers that go back to
+//the ring once the streamer has copied them out
+class UringSource : public StreamSource
+{
+	public:
+		UringSource(IoUring * ring) : bEof(false), iError(0), pRing(ring) {}
+		~UringSource() { clear(); }
+
+		void push(uint16_t bid, int len);
+		void clear();
+		int iRead(char * sBuf, int iLen);
+
+		bool bEof;
+		int iError;
+
+	private:
+		struct Chunk { uint16_t bid; int off; int len; };
+		IoUring * pRing;
+		std::deque<Chunk> Chunks;
+};
+
+//Output bytes of a session. Appends go in after iTail while the bytes from iHead are
+//being sent, data that wraps the end goes out as two iovecs.
+struct OutputRing
+{
+	char * sBuf;
+	uint32_t iMask;
+	uint32_t iHead;
+	uint32_t iTail;
+
+	void init(int iSize);
+	void release();
+	int size() const     { return (int) (iTail - iHead); }
+	int capacity() const { return (sBuf != NULL)? (int) iMask + 1: 0; }
+	int space() const    { return capacity() - size(); }
+	void append(const char * Msg, int iLen);
+	//fills upto 2 iovecs with the pending bytes, returns the count
+	int iovecs(struct iovec * iov) const;
+	void consume(int iLen);
+};
+
+//Per session counters, updated by the event loop (see StatAdd) and read with
+//ux_selector::getStats from any thread
+struct SessionCounters
+{
+	StreamCounters IO;      //bytes and syscalls, kept by the streamer
+	uint64_t iMsgsIn;       //msgs handed out by Read/ReadView/ReadBatch
+	uint64_t iMsgsOut;      //msgs put in the output ring
+	uint64_t iQueueDepth;   //bytes waiting now (ring + backlog)
+	uint64_t iQueued;       //msgs parked in the backlog while congested
+	uint64_t iDropped;      //backlog msgs dropped (POLICY_DROP_OLDEST/CONFLATE)
+	uint64_t iConflated;    //backlog msgs replaced by a newer one with the same key
+	uint64_t iWouldBlock;   //writes refused (POLICY_BLOCK)
+	uint64_t iCongested;    //times the high watermark was crossed
+	uint64_t iMaxPending;   //peak bytes waiting (ring + backlog)
+};
+
+//Log2 histogram of nanos, bucket i counts [2^i, 2^(i+1)), the last one takes the rest
+static const int iStatBuckets = 32;
+int StatBucket(uint64_t iNanos);
+//Upper bound (nanos) of the bucket holding the given percentile (0-100) of the samples
+uint64_t StatPercentile(const uint64_t * Histogram, double dPercentile);
+
+//Event loop counters, read with ux_selector::getStats
+struct SelectorStats
+{
+	uint64_t iPolls;                        //PollForSocketEvent calls
+	uint64_t iWakeups;                      //polls that returned events
+	uint64_t iEvents;
+	uint64_t iPollNanos[iStatBuckets];      //time inside PollForSocketEvent (flush + wait)
+	uint64_t iLoopNanos[iStatBuckets];      //time between polls, spent handling the events
+};
+
+//Gets the backpressure state changes of sessions (ux_selector::SESSION_*)
+class SessionListener
+{
+	public:
+		virtual ~SessionListener() {}
+		virtual void onSessionState(int iClientID, int iOldState, int iNewState) = 0;
+		//msgs with the same non zero key replace each other in the backlog (POLICY_CONFLATE)
+		virtual uint64_t conflateKey(int /*iClientID*/, const char * /*Msg*/, int /*MsgLen*/) { return 0; }
+};
+
 struct SocketSession
 {
 	SocketStreamerBase *Streamer;
@@ -21,20 +109,74 @@ struct SocketSession
 	int iMaxMsgSize;
 	int iHeaderSize;
 	bool SkipNL;
-	char * sMsg;
-	int iAmountWritten;
-	int iWriteMsgLen;
+	OutputRing Out;
+	bool bDirty;
+	uint64_t iDirtySince;
+	bool bWriteArmed;
+	//backpressure
+	int iState;
+	int iPolicy;
+	int iHighWatermark;
+	int iLowWatermark;
+	int iMaxBacklog;
+	std::deque<std::pair<uint64_t, std::string> > Backlog;
+	int iBacklogBytes;
+	SessionCounters Counters;
+	//io_uring backend
+	UringSource * Source;
+	int iSendInFlight;
+	unsigned iGeneration;
+	bool bRecvArmed;
+};
+
+//One msg of a ReadBatch. pMsg is NULL for a session that disconnected (iMsgLen is DISCONNECT)
+struct SocketMsgView
+{
+	int iClientID;
+	const char * pMsg;
+	int iMsgLen;
 };
 
 class ux_selector
 {
 	public:
-		ux_selector(int PollTimeout=-1); //blocks if -1
+		//BACKEND_POLL scans every socket on each poll/read. BACKEND_EPOLL is edge triggered
+		//and keeps a ready list, so the cost follows the active sockets only.
+		//BACKEND_URING keeps a multishot receive armed per session and batches the sends
+		//of a poll pass into one io_uring_enter (kernel 6.0+).
+		enum Backend { BACKEND_POLL, BACKEND_EPOLL, BACKEND_URING };
+
+		//What a write does once a session is over its high watermark
+		//POLICY_BLOCK returns WOULD_BLOCK to the producer
+		//POLICY_DROP_OLDEST parks msgs in a bounded backlog, dropping the oldest when full
+		//POLICY_CONFLATE is DROP_OLDEST where a msg replaces a parked one with the same key
+		//POLICY_DISCONNECT drops the session
+		enum Policy { POLICY_BLOCK, POLICY_DROP_OLDEST, POLICY_CONFLATE, POLICY_DISCONNECT };
+		enum SessionState { SESSION_OK, SESSION_CONGESTED, SESSION_CLOSED };
+
+		//Watermarks are pending bytes. 0 picks the defaults: high is the output ring size,
+		//low is half of high and the backlog can hold a ring worth of msgs
+		struct Backpressure
+		{
+			Policy ePolicy;
+			int iHighWatermark;
+			int iLowWatermark;
+			int iMaxBacklog;
+			Backpressure(Policy policy = POLICY_BLOCK, int iHigh = 0, int iLow = 0, int iBacklog = 0) :
+				ePolicy(policy), iHighWatermark(iHigh), iLowWatermark(iLow), iMaxBacklog(iBacklog) {}
+		};
+
+		ux_selector(int PollTimeout=-1, Backend backend = BACKEND_POLL); //blocks if -1
 		~ux_selector();
 
+		//BACKEND_URING falls back to BACKEND_EPOLL, which falls back to BACKEND_POLL
+		//when the kernel does not support it
+		Backend getBackend() const { return iBackend; }
+
         void setPollBlocking(bool stat) { iPollTimeout = (stat)? -1:0; }
     
-		int AddServer(int ServerPort);
+		//bReusePort lets several selectors (threads) listen on the same port
+		int AddServer(int ServerPort, bool bReusePort = false);
 
 		//Returns clientID 		
 		int AddClient(SocketStreamerBase *Streamer, int iMaxMsgSize, int iHeaderSize, bool SkipNL);
@@ -43,20 +185,55 @@ class ux_selector
 
 		int PollForSocketEvent();
 
-		//Writes are non-blocking (return WOULD_BLOCK after max attempts and store the unwritten msg)
-		//During next request, if we still get blocking errors, it will disconnect. 
-		//Writes are buffered to maximize the TCP payload.
+		//Writes are non-blocking and go through the session output ring, whatever the
+		//socket does not take stays there for the next flush. WOULD_BLOCK means the ring
+		//is full and the msg was not taken.
+		//Writes are corked (see setCork) to maximize the TCP payload.
+		//With BACKEND_URING writes queue a send that goes out on the next poll or flush.
 		int Write(int iClientID, char * Msg, int MsgLen); 
 
+		//Holds writes until iBytes are pending for a session or the oldest of them is
+		//iMicros old, checked on every poll. Default (0, 0) writes each msg right away.
+		void setCork(int iBytes, int iMicros) { iCorkBytes = iBytes; iCorkMicros = iMicros; }
+		//Output ring size for sessions added later, rounded up to a power of two.
+		//Default is room for 16 msgs of iMaxMsgSize
+		void setOutputBuffer(int iBytes) { iOutputBytes = iBytes; }
+
+		//Backpressure for sessions added later, or for one session
+		void setBackpressure(const Backpressure & config) { DefaultBackpressure = config; }
+		int setBackpressure(int iClientID, const Backpressure & config);
+		void setListener(SessionListener * listener) { pListener = listener; }
+		int getState(int iClientID) const;
+		//Bumped each time AddClient reuses the slot, tells a session from earlier ones
+		//with the same iClientID. Kept after RemoveClient until the slot is reused.
+		unsigned getGeneration(int iClientID) const;
+
+		//Lock free snapshots, safe to take from another thread while the loop runs.
+		//Session counters are reset when the slot is reused by AddClient.
+		int getStats(int iClientID, SessionCounters & Snapshot) const;
+		void getStats(SelectorStats & Snapshot) const { StatSnapshot(Stats, Snapshot); }
+
         int Publish(int iClientID, char * Msg, int MsgLen);
+		//One sendmmsg for all the datagrams, returns the number sent or FAILURE
+		int PublishBatch(int iClientID, const struct iovec * Msgs, int iCount);
     
-		//call flush to push out the buffered data. 
+		//call flush to push out the buffered (corked) data. 
 		//Use when there is no additional I/O due to inactivity
 		void flush(); 
 		
 		//Returns Error code shown below  		
 		int Read(int &iClientID, char * Msg); 
 
+		//Zero copy Read, pMsg points into the session's receive buffer and stays valid
+		//until the next Read/ReadView or Release
+		int ReadView(int &iClientID, const char *& pMsg, int &iMsgLen);
+		void Release(int iClientID);
+
+		//Every complete msg of the ready sessions in one pass, at most iMaxPerSession
+		//per session (0 for no cap) so a burst on one socket does not starve the rest.
+		//Views stay valid until the next ReadBatch. Returns the number of entries.
+		int ReadBatch(std::vector<SocketMsgView> & Msgs, int iMaxPerSession = 0);
+
 		//Returns Error code shown below  		
 		int Accept(int &iServerPort, int &iClientFD); 
 
@@ -72,6 +249,29 @@ class ux_selector
 
 		void ConfigureSocketOptions(int iSessionFD);
 		int WriteInternal(int iClientID); 
+		int FlushSession(int iClientID);
+		void FlushDirty(bool bAll);
+		void MarkDirty(int iClientID);
+		bool AwaitOutput(int iClientID);
+		void SetWriteInterest(int iClientID, bool bArm);
+		void Writable(int iClientID);
+		bool Admit(int iClientID, int MsgLen) const;
+		int Congested(int iClientID, char * Msg, int MsgLen);
+		void Refill(int iClientID);
+		void SetState(int iClientID, int iState);
+		void TrackDepth(int iClientID);
+		int WaitForEvents();
+		int ReadNext(int &iClientID, char * Msg, const char ** pView, int * pLen);
+		int ReadEpoll(int &iClientID, char * Msg, const char ** pView, int * pLen);
+		int ReadSession(int iClient, char * Msg, const char ** pView, int * pLen);
+		int DrainSession(int iClient, std::vector<SocketMsgView> & Msgs, int iMaxMsgs, bool & bDrained);
+		void RemoveReady(int iPos);
+		void AddReady(int iClient);
+
+		bool InitUring();
+		int PollUring(int iTimeout);
+		void QueueSend(int iClientID);
+		uint64_t UringTag(int iKind, int iClient) const;
 
 		//Max values
 		static const int  iMaxAccept = 20;
@@ -81,15 +281,19 @@ class ux_selector
 		static const int  iOutputeadBuffer = -1;
 		static const bool bNagleOff = true;
 
-		//Maximum transmission unit for Ethernet is 1500. 
-		//Set under 1400 after accounting for overheads (IP+UDP headers)
-		//to avoid packet fragmentation. Default is no buffering
-		static const int  WRITE_BUFF_SIZE = 0;
+		//Default output ring, in msgs of iMaxMsgSize
+		static const int  iOutputMsgs = 16;
 
 		//These 2 values cause disconnects as the load on socket grows. 
 		static const int  iMaxReadAttempts = 3;
 		static const int  iMaxWriteAttepts = 3;
 
+		//io_uring sizing: ring entries and receive buffers
+		static const int  iUringEntries = 256;
+		static const int  iUringBufCount = 512;
+		static const int  iUringBufSize = 4096;
+		enum { URING_RECV = 1, URING_SEND = 2, URING_ACCEPT = 3 };
+
 		int iAcceptSocketFD[iMaxAccept];
 		int iAcceptPort[iMaxAccept];
 
@@ -98,6 +302,39 @@ class ux_selector
 		int iMaxPollFD;     
         
 		int iPollTimeout; 
+
+		//epoll backend, sessions stay on the ready list until a read drains the socket
+		Backend iBackend;
+		int iEpollFD;
+		struct epoll_event Events[iMaxClient+iMaxAccept];
+		int iReadyList[iMaxClient];
+		int iReadyCount;
+		bool bReady[iMaxClient+iMaxAccept];
+
+		//io_uring backend shares the ready list, completions are turned into ready sessions
+		IoUring * pRing;
+		IoCompletion Completions[iUringEntries];
+		int iRearmList[iMaxClient];
+		int iRearmCount;
+		//write buffers of removed sessions whose send is still in flight
+		std::vector<std::pair<uint64_t, char *> > Orphans;
+
+		//sessions holding views handed out by the last ReadBatch
+		std::vector<int> HeldSessions;
+
+		//corked sessions with output not written yet, output the socket did not take
+		//waits for write readiness instead
+		int iDirtyList[iMaxClient];
+		int iDirtyCount;
+		int iCorkBytes;
+		int iCorkMicros;
+		int iOutputBytes;
+
+		Backpressure DefaultBackpressure;
+		SessionListener * pListener;
+
+		SelectorStats Stats;
+		uint64_t iLastPollDone;
 		
 		//Transient
 		int iNextAcceptPollIdx;